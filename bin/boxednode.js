@@ -7,7 +7,7 @@ const argv = require('yargs')
     alias: 'c', type: 'boolean', desc: 'Clean up temporary directory after success'
   })
   .option('source', {
-    alias: 's', type: 'string', demandOption: true, desc: 'Source .js file'
+    alias: 's', type: 'string', demandOption: true, desc: 'Source .js or .mjs file'
   })
   .option('target', {
     alias: 't', type: 'string', demandOption: true, desc: 'Target executable file'
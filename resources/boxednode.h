@@ -0,0 +1,60 @@
+// C API of shared libraries that are built with the `sharedLibrary` option.
+// It allows running the embedded entry points repeatedly in-process, without
+// paying for process startup and V8 initialization for each run.
+//
+// All functions must be called from the same thread.
+
+#ifndef BOXEDNODE_H_
+#define BOXEDNODE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BOXEDNODE_EXTERN __attribute__((visibility("default")))
+#else
+#define BOXEDNODE_EXTERN
+#endif
+
+typedef struct boxednode_instance boxednode_instance;
+
+// Initializes Node.js and V8. This must be called once per process, before
+// any other function. `argv[0]` is the program name, and the remaining
+// arguments are Node.js options (e.g. `--max-old-space-size=4096`).
+// Returns 0 on success, or an exit code if the options are invalid.
+BOXEDNODE_EXTERN int boxednode_initialize(int argc, const char* const* argv);
+
+// Creates an instance for the entry point with the given name, or the default
+// one if `entry_point` is NULL or empty. An instance owns a V8 Isolate that is
+// created from the embedded snapshot, if any, and re-used between runs.
+// Returns NULL if the entry point does not exist or the Isolate could not be
+// created.
+BOXEDNODE_EXTERN boxednode_instance* boxednode_instance_create(const char* entry_point);
+
+// Runs the entry point in a fresh Node.js environment, with `argv` as the
+// arguments following the executable name in `process.argv`, until its event
+// loop is empty or `process.exit()` is called. Returns the exit code.
+// If `result` is not NULL, it is set to a copy of `process.boxednode.result`
+// if the entry point set it to a string, or to NULL otherwise. The copy is
+// NUL-terminated, so a result that itself contains NUL characters appears
+// truncated at the first one. The copy needs to be released with
+// boxednode_free().
+BOXEDNODE_EXTERN int boxednode_instance_run(boxednode_instance* instance,
+                                            int argc,
+                                            const char* const* argv,
+                                            char** result);
+
+BOXEDNODE_EXTERN void boxednode_instance_dispose(boxednode_instance* instance);
+
+BOXEDNODE_EXTERN void boxednode_free(char* result);
+
+// Releases all resources that boxednode_initialize() has acquired. No other
+// functions may be called afterwards.
+BOXEDNODE_EXTERN void boxednode_teardown(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOXEDNODE_H_
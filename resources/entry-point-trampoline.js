@@ -6,10 +6,14 @@ const path = require('path');
 const assert = require('assert');
 const {
   requireMappings,
-  enableBindingsPatch
+  enableBindingsPatch,
+  trackStartupMemory,
+  moduleEntryPoints,
+  startupReport,
+  profileRequire
 } = REPLACE_WITH_BOXEDNODE_CONFIG;
 const hydatedRequireMappings =
-  requireMappings.map(([re, reFlags, linked]) => [new RegExp(re, reFlags), linked]);
+  requireMappings.map(([re, reFlags, linked, addonDir]) => [new RegExp(re, reFlags), linked, addonDir]);
 
 if (process.argv[2] === '--') process.argv.splice(2, 1);
 
@@ -54,17 +58,605 @@ if (enableBindingsPatch) {
   });
 }
 
+// Stand-ins for the `bindings` and `node-gyp-build` packages, which locate
+// addon files through stack traces and the file system. They return the
+// linked addon that matches one of the files that the package would load,
+// or otherwise one that was built from a directory along `fromPath`.
+const bindingsTryDirs = [
+  'build', 'build/Debug', 'build/Release', 'out/Debug', 'Debug', 'out/Release',
+  'Release', 'build/default', `compiled/${process.versions.node}/${process.platform}/${process.arch}`,
+  'addon-build/release/install-root', 'addon-build/debug/install-root',
+  'addon-build/default/install-root',
+  `lib/binding/node-v${process.versions.modules}-${process.platform}-${process.arch}`
+];
+
+// The files that node-gyp-build looks for in `dir`: the first addon in
+// build/Release or build/Debug, whose name is usually that of the package,
+// and prebuilds for the current platform, which prebuildify names after the
+// runtime or the package and ABI tags (e.g. `node.napi.glibc.node`).
+function nodeGypBuildFiles(dir) {
+  const names = [path.basename(dir)];
+  try {
+    const { name } = JSON.parse(require('fs').readFileSync(path.join(dir, 'package.json'), 'utf8'));
+    names.push(name.replace(/^@[^/]+\//, ''));
+  } catch {}
+  const prebuildsDir = path.join(dir, 'prebuilds', `${process.platform}-${process.arch}`);
+  const tags = ['napi', `abi${process.versions.modules}`].flatMap(
+    tag => [tag, `${tag}.glibc`, `${tag}.musl`]);
+  return [
+    ...names.flatMap(name => ['Release', 'Debug'].map(
+      config => path.join(dir, 'build', config, `${name}.node`))),
+    ...['node', ...names].flatMap(name => tags.map(
+      tag => path.join(prebuildsDir, `${name}.${tag}.node`)))
+  ];
+}
+
+function loadLinkedAddon(candidateFiles, fromPath, description) {
+  const pathComponents = fromPath.split(/[\\/]/);
+  const candidates = [
+    ...candidateFiles.flatMap(file => hydatedRequireMappings.filter(([re]) => re.test(file))),
+    ...hydatedRequireMappings.filter(([,, addonDir]) => pathComponents.includes(addonDir))
+  ];
+  for (const [, linked] of candidates) {
+    try {
+      return process._linkedBinding(linked);
+    } catch {}
+  }
+  throw new Error(`Could not find a linked addon for ${description}`);
+}
+
+const linkedAddonLoaders = {
+  bindings: (fromFile) => (opts = {}) => {
+    if (typeof opts === 'string') opts = { bindings: opts };
+    let name = opts.bindings || 'bindings.node';
+    if (path.extname(name) !== '.node') name += '.node';
+    const root = path.dirname(fromFile);
+    return loadLinkedAddon(bindingsTryDirs.map(dir => path.join(root, dir, name)), fromFile, name);
+  },
+  'node-gyp-build': () => (dir) => {
+    dir = path.resolve(dir || '.');
+    return loadLinkedAddon(nodeGypBuildFiles(dir), dir, dir);
+  }
+};
+
+// Records a tree of the modules that are loaded through require(), see the
+// `profileRequire` build option. `measure()` adds a node for loading a module
+// below the one that is currently being loaded, and `resolve()` and
+// `compile()` attribute time to the current node. Evaluation time is what
+// remains of a node's total time. Times are in nanoseconds.
+function createRequireProfiler(filename) {
+  const now = () => process.hrtime.bigint();
+  const createNode = (request, type, filename = null) => ({
+    request,
+    type,
+    filename,
+    cached: false,
+    codeCache: false,
+    start: now(),
+    totalTime: null, // null while the module is being loaded
+    resolveTime: 0n,
+    compileTime: 0n,
+    children: []
+  });
+
+  let root;
+  let current;
+  const reset = () => {
+    root = current = createNode('.', 'main', filename);
+  };
+  reset();
+
+  function measure(request, type, load) {
+    const parent = current;
+    const node = createNode(request, type);
+    parent.children.push(node);
+    current = node;
+    try {
+      return load(node);
+    } finally {
+      node.totalTime = now() - node.start;
+      current = parent;
+    }
+  }
+
+  function addTime(key, fn) {
+    const node = current;
+    const start = now();
+    try {
+      return fn(node);
+    } finally {
+      node[key] += now() - start;
+    }
+  }
+
+  function serialize(node, origin) {
+    const children = node.children.map(child => serialize(child, origin));
+    const totalTime = Number(node.totalTime ?? now() - node.start);
+    const evaluationTime = totalTime - Number(node.resolveTime) - Number(node.compileTime);
+    return {
+      request: node.request,
+      type: node.type,
+      filename: node.filename,
+      cached: node.cached,
+      codeCache: node.codeCache,
+      start: Number(node.start - origin),
+      totalTime,
+      resolveTime: Number(node.resolveTime),
+      compileTime: Number(node.compileTime),
+      evaluationTime,
+      selfTime: evaluationTime - children.reduce((sum, child) => sum + child.totalTime, 0),
+      children
+    };
+  }
+
+  // Start and end of each require() call, in the format of getTimingData().
+  function getTimingEntries() {
+    const entries = [];
+    const visit = (node) => {
+      for (const child of node.children) {
+        const label = `require(${JSON.stringify(child.request)})`;
+        entries.push(['Boxednode Require', `Start ${label}`, child.start]);
+        visit(child);
+        if (child.totalTime !== null) {
+          entries.push(['Boxednode Require', `Finished ${label}`, child.start + child.totalTime]);
+        }
+      }
+    };
+    visit(root);
+    return entries;
+  }
+
+  return {
+    get root() { return root; },
+    get current() { return current; },
+    reset,
+    measure,
+    resolve: (fn) => addTime('resolveTime', fn),
+    compile: (fn) => addTime('compileTime', fn),
+    finish() {
+      if (root.totalTime === null) root.totalTime = now() - root.start;
+    },
+    serialize: (origin) => serialize(root, origin),
+    getTimingEntries
+  };
+}
+
+const isBuiltinRequest = (request) =>
+  request.startsWith('node:') || Module.builtinModules.includes(request);
+
+// Records modules that Node.js loads from the file system (or built-in ones)
+// in `profiler`. Their compile time is part of their evaluation time.
+// `forward()` runs a require() call that has already been recorded.
+// This wraps `Module.prototype.require` and `Module._resolveFilename` for
+// the lifetime of the process, since modules can be loaded at any time.
+function installRequireProfilerHooks(profiler, trampolineModule) {
+  const origRequire = Module.prototype.require;
+  const origResolveFilename = Module._resolveFilename;
+  let skipNext = false;
+  // Set while Node.js has yet to resolve the module of a recorded require()
+  // call, so that other resolutions (e.g. `require.resolve()` calls) are not
+  // attributed to the module that is currently being loaded.
+  let resolvingRecorded = false;
+
+  const requireRecorded = (mod, id) => {
+    resolvingRecorded = true;
+    try {
+      return origRequire.call(mod, id);
+    } finally {
+      resolvingRecorded = false;
+    }
+  };
+
+  // Node.js does not resolve repeated require() calls from the same module
+  // again, and returns the already loaded module.
+  const markCached = (node, resolve) => {
+    if (node.filename !== null) return;
+    node.cached = true;
+    try {
+      node.filename = resolve();
+    } catch {}
+  };
+
+  Module.prototype.require = function(id) {
+    if (skipNext) {
+      skipNext = false;
+      return requireRecorded(this, id);
+    }
+    if (this === trampolineModule) {
+      return origRequire.call(this, id);
+    }
+    const isBuiltin = isBuiltinRequest(id);
+    return profiler.measure(id, isBuiltin ? 'builtin' : 'file', (node) => {
+      if (isBuiltin) node.filename = id;
+      const exports = requireRecorded(this, id);
+      markCached(node, () => Module._resolveFilename(id, this, false));
+      return exports;
+    });
+  };
+  Module._resolveFilename = function(...args) {
+    if (!resolvingRecorded) return origResolveFilename.apply(this, args);
+    resolvingRecorded = false;
+    return profiler.resolve((node) => {
+      const filename = origResolveFilename.apply(this, args);
+      if (node.filename === null) {
+        node.filename = filename;
+        node.cached = Object.prototype.hasOwnProperty.call(Module._cache, filename);
+      }
+      return filename;
+    });
+  };
+  return {
+    forward(node, load, resolve) {
+      skipNext = true;
+      let exports;
+      try {
+        exports = load();
+      } finally {
+        skipNext = false;
+      }
+      markCached(node, resolve);
+      return exports;
+    }
+  };
+}
+
+// Loader for the CommonJS modules embedded into the binary (see
+// src/embedded-modules.ts). Static require() calls were resolved at build
+// time; dynamic ones are resolved here using a subset of the Node.js
+// resolution algorithm. Modules are evaluated without touching the file
+// system, which also makes this usable while building a startup snapshot.
+function createEmbeddedModuleLoader({ entry, files, resolutions }, baseDir, compileModule, makeRequire) {
+  // The entry point's source is not part of `files`, since it is run as the
+  // main script. Requiring it returns the main module's exports, like in
+  // Node.js, once `setEntryModule()` has been called.
+  let entryModule = null;
+  const hasFile = (file) => file === entry || Object.prototype.hasOwnProperty.call(files, file);
+  const tryFile = (file) => hasFile(file) ? file : null;
+  const tryExtensions = (file) =>
+    tryFile(file) ?? tryFile(`${file}.js`) ?? tryFile(`${file}.json`) ?? tryFile(`${file}.cjs`);
+  const tryIndex = (dir) => tryFile(`${dir}/index.js`) ?? tryFile(`${dir}/index.json`);
+  const tryDirectory = (dir) => {
+    const pkg = tryFile(`${dir}/package.json`);
+    const main = pkg && JSON.parse(files[pkg]).main;
+    if (main) {
+      const mainPath = path.posix.join(dir, main);
+      const resolved = tryExtensions(mainPath) ?? tryIndex(mainPath);
+      if (resolved) return resolved;
+    }
+    return tryIndex(dir);
+  };
+  const tryPath = (file) => tryExtensions(file) ?? tryDirectory(file);
+
+  // Returns the embedded file that `request` refers to, or null.
+  function resolve(request, from) {
+    if (request.startsWith('node:') || Module.builtinModules.includes(request)) {
+      return null;
+    }
+    const fileResolutions = resolutions[from];
+    if (fileResolutions && Object.prototype.hasOwnProperty.call(fileResolutions, request)) {
+      return fileResolutions[request];
+    }
+    if (request === '.' || request === '..' || request.startsWith('./') || request.startsWith('../')) {
+      return tryPath(path.posix.join(path.posix.dirname(from), request));
+    }
+    if (path.isAbsolute(request)) {
+      const relative = path.relative(baseDir, request).split(path.sep).join('/');
+      return relative.startsWith('..') ? null : tryPath(relative);
+    }
+    for (let dir = path.posix.dirname(from); ; dir = path.posix.dirname(dir)) {
+      const resolved = tryPath(path.posix.join(dir, 'node_modules', request));
+      if (resolved) return resolved;
+      if (dir === '.') return null;
+    }
+  }
+
+  const filename = (file) => path.join(baseDir, ...file.split('/'));
+
+  const cache = new Map();
+  function load(file) {
+    if (file === entry) {
+      if (!entryModule) {
+        throw new Error(`Cannot require() the entry point ${filename(file)} from an embedded module`);
+      }
+      return entryModule.exports;
+    }
+    const cached = cache.get(file);
+    if (cached) return cached.exports;
+    const module = {
+      exports: {},
+      children: [],
+      filename: filename(file),
+      id: filename(file),
+      path: path.dirname(filename(file)),
+      loaded: false,
+      require: makeRequire(file)
+    };
+    cache.set(file, module);
+    try {
+      if (file.endsWith('.json')) {
+        module.exports = JSON.parse(files[file]);
+      } else {
+        compileModule(files[file], module.filename).call(
+          module.exports, module.filename, module.path, module.require, module.exports, module);
+      }
+    } catch (err) {
+      cache.delete(file);
+      throw err;
+    }
+    module.loaded = true;
+    return module.exports;
+  }
+
+  return {
+    resolve,
+    load,
+    filename,
+    isLoaded: (file) => file === entry ? !!entryModule : cache.has(file),
+    setEntryModule: (module) => {
+      entryModule = module;
+    }
+  };
+}
+
+// Code caches for ES module entry points are stored as a single blob that
+// contains one code cache per module record: a 4-byte little-endian header
+// length, a JSON header mapping embedded files to [offset, length] pairs, and
+// the concatenated code caches.
+function serializeCodeCaches(caches) {
+  const header = {};
+  let offset = 0;
+  for (const [file, data] of caches) {
+    header[file] = [offset, data.length];
+    offset += data.length;
+  }
+  const headerData = Buffer.from(JSON.stringify(header));
+  const headerLength = Buffer.alloc(4);
+  headerLength.writeUInt32LE(headerData.length);
+  return Buffer.concat([headerLength, headerData, ...caches.values()]);
+}
+
+function deserializeCodeCaches(blob) {
+  const caches = new Map();
+  if (blob.length === 0) return caches;
+  const data = Buffer.from(blob.buffer, blob.byteOffset, blob.byteLength);
+  const headerLength = data.readUInt32LE(0);
+  const header = JSON.parse(data.toString('utf8', 4, 4 + headerLength));
+  const start = 4 + headerLength;
+  for (const [file, [offset, length]] of Object.entries(header)) {
+    caches.set(file, data.subarray(start + offset, start + offset + length));
+  }
+  return caches;
+}
+
+// Runs an ES module entry point using vm.SourceTextModule (the binary passes
+// --experimental-vm-modules for this). Embedded ES modules are linked from
+// the binary, with a code cache for each of them. CommonJS and built-in
+// modules are wrapped in synthetic modules; note that unlike in Node.js,
+// they are evaluated while linking rather than while evaluating.
+function runModuleEntry({ src, filename, codeCacheMode, codeCache, runtimeCodeCache, moduleGraph, embeddedModules, makeRequire, requireProfiler, skipEvaluation }) {
+  const { SourceTextModule, SyntheticModule } = vm;
+  const { pathToFileURL, fileURLToPath } = outerRequire('url');
+
+  const codeCaches = deserializeCodeCaches(codeCache);
+  const esModules = new Set(moduleGraph.esModules);
+  const records = new Map();
+  const recordFiles = new WeakMap();
+  let rejectedCodeCache = false;
+
+  function createSourceTextModule(source, file, identifier) {
+    const options = {
+      identifier,
+      initializeImportMeta(meta) {
+        meta.url = pathToFileURL(identifier).href;
+      },
+      importModuleDynamically: (specifier) => importDynamically(specifier, file)
+    };
+    const compile = () => {
+      let record;
+      const cachedData = codeCaches.get(file);
+      if (cachedData) {
+        try {
+          record = new SourceTextModule(source, { ...options, cachedData });
+        } catch (err) {
+          if (err?.code !== 'ERR_VM_MODULE_CACHED_DATA_REJECTED') throw err;
+          rejectedCodeCache = true;
+        }
+      }
+      return record ?? new SourceTextModule(source, options);
+    };
+    // ES modules are compiled while linking and evaluated as a whole, so
+    // their times are attributed to the entry point when profiling.
+    const record = requireProfiler ? requireProfiler.compile(compile) : compile();
+    recordFiles.set(record, file);
+    return record;
+  }
+
+  function createSyntheticModule(identifier, getExports) {
+    const value = getExports();
+    const names = value !== null && ['object', 'function'].includes(typeof value) ?
+      Object.keys(value).filter(name => name !== 'default') : [];
+    return new SyntheticModule(['default', ...names], function() {
+      this.setExport('default', value);
+      for (const name of names) this.setExport(name, value[name]);
+    }, { identifier });
+  }
+
+  function getEmbeddedRecord(file) {
+    if (!records.has(file)) {
+      const identifier = embeddedModules.filename(file);
+      records.set(file, esModules.has(file) ?
+        createSourceTextModule(moduleGraph.files[file], file, identifier) :
+        createSyntheticModule(identifier, () => requireProfiler ?
+          requireProfiler.measure(file, 'embedded', (node) => {
+            node.filename = identifier;
+            node.cached = embeddedModules.isLoaded(file);
+            return embeddedModules.load(file);
+          }) :
+          embeddedModules.load(file)));
+    }
+    return records.get(file);
+  }
+
+  function getRecord(specifier, from) {
+    if (specifier.startsWith('file:')) {
+      specifier = fileURLToPath(specifier);
+    }
+    const file = embeddedModules.resolve(specifier, from);
+    if (file) {
+      return getEmbeddedRecord(file);
+    }
+    // Other imports are loaded like require() calls from the importing file,
+    // which also resolves linked addons.
+    const key = `external:${from}:${specifier}`;
+    if (!records.has(key)) {
+      records.set(key, createSyntheticModule(specifier, () => makeRequire(from)(specifier)));
+    }
+    return records.get(key);
+  }
+
+  const linker = (specifier, referencingModule) =>
+    getRecord(specifier, recordFiles.get(referencingModule));
+
+  async function importDynamically(specifier, from) {
+    const record = getRecord(specifier, from);
+    if (record.status === 'unlinked') {
+      await record.link(linker);
+    }
+    await record.evaluate();
+    return record;
+  }
+
+  // Node.js warns about vm modules being experimental once, when the first
+  // module record is created. Only that warning is suppressed, and the
+  // original process.emitWarning() is restored afterwards.
+  const origEmitWarning = process.emitWarning;
+  process.emitWarning = function(warning, ...args) {
+    const type = args[0]?.type ?? args[0];
+    if (type === 'ExperimentalWarning' && String(warning).includes('VM Modules')) {
+      return;
+    }
+    return origEmitWarning.call(this, warning, ...args);
+  };
+  let main;
+  try {
+    main = createSourceTextModule(src, moduleGraph.entry, filename);
+  } finally {
+    process.emitWarning = origEmitWarning;
+  }
+  if (codeCacheMode === 'generate') {
+    // Code caches can be created without linking, which would mean running
+    // CommonJS dependencies at build time. This also covers modules that are
+    // only loaded through import().
+    const caches = new Map([[moduleGraph.entry, main.createCachedData()]]);
+    for (const file of esModules) {
+      if (file !== moduleGraph.entry) {
+        caches.set(file, getEmbeddedRecord(file).createCachedData());
+      }
+    }
+    outerRequire('fs').writeFileSync('intermediate.out', serializeCodeCaches(caches));
+    return;
+  }
+
+  process.boxednode.hasCodeCache = codeCaches.size > 0;
+  return main.link(linker).then(() => {
+    process.boxednode.rejectedCodeCache = rejectedCodeCache;
+    if (requireProfiler) {
+      requireProfiler.root.codeCache = codeCaches.size > 0 && !rejectedCodeCache;
+    }
+    if (runtimeCodeCache && (!runtimeCodeCache.data || rejectedCodeCache)) {
+      // Module records cannot create code caches once they have been
+      // evaluated, so lazily compiled functions are not covered here.
+      const caches = new Map();
+      for (const record of [main, ...records.values()]) {
+        if (record instanceof SourceTextModule) {
+          caches.set(recordFiles.get(record), record.createCachedData());
+        }
+      }
+      const data = serializeCodeCaches(caches);
+      runtimeCodeCache.update(() => data);
+    }
+    if (skipEvaluation) return;
+    const evaluation = main.evaluate();
+    return requireProfiler ? evaluation.finally(() => requireProfiler.finish()) : evaluation;
+  });
+}
+
+const kRuntimeCodeCacheWarmupMs = 10000;
+
+function defaultCacheDirectory() {
+  const os = outerRequire('os');
+  switch (process.platform) {
+    case 'win32':
+      return process.env.LOCALAPPDATA && path.join(process.env.LOCALAPPDATA, 'boxednode');
+    case 'darwin':
+      return path.join(os.homedir(), 'Library', 'Caches', 'boxednode');
+    default:
+      return path.join(process.env.XDG_CACHE_HOME || path.join(os.homedir(), '.cache'), 'boxednode');
+  }
+}
+
+// A code cache that is written at runtime and then preferred over the
+// embedded one, see the `runtimeCodeCache` build option. Cache files are
+// specific to the build, the entry point and the V8 version and flags
+// (through v8.cachedDataVersionTag()). Errors are ignored, since the cache
+// is only an optimization.
+function openRuntimeCodeCache(key, entryPoint) {
+  const fs = outerRequire('fs');
+  const dir = process.env.BOXEDNODE_CODE_CACHE_DIR || defaultCacheDirectory();
+  if (!dir) return null;
+  const file = path.join(
+    dir, `${key}-${entryPoint || 'default'}-${v8.cachedDataVersionTag()}.codecache`);
+  let data = null;
+  try {
+    data = fs.readFileSync(file);
+  } catch {}
+
+  let written = false;
+  return {
+    data,
+    // `createCachedData` is called once the process has warmed up or when it
+    // exits, whichever happens first, so that the cache includes lazily
+    // compiled functions. The file is renamed into place atomically.
+    update(createCachedData) {
+      const write = () => {
+        if (written) return;
+        written = true;
+        const tmpFile = `${file}.${process.pid}.tmp`;
+        try {
+          fs.mkdirSync(dir, { recursive: true, mode: 0o700 });
+          fs.writeFileSync(tmpFile, createCachedData());
+          fs.renameSync(tmpFile, file);
+        } catch {
+          try { fs.unlinkSync(tmpFile); } catch {}
+        }
+      };
+      setTimeout(write, kRuntimeCodeCacheWarmupMs).unref();
+      process.once('exit', write);
+    }
+  };
+}
+
 const outerRequire = require;
-module.exports = (src, codeCacheMode, codeCache) => {
+const trampolineModule = module;
+// `entryPoint` is the name of the selected entry point, which is empty for
+// the default one. `runtimeCodeCacheKey` is empty unless the runtime code
+// cache is enabled.
+module.exports = (src, codeCacheMode, codeCache, moduleGraphSource, entryPoint, runtimeCodeCacheKey) => {
   const __filename = process.execPath;
   const __dirname = path.dirname(process.execPath);
   let innerRequire;
   const exports = {};
   const isBuildingSnapshot = () => !!v8?.startupSnapshot?.isBuildingSnapshot();
   const usesSnapshot = isBuildingSnapshot();
+  const requireProfiler = profileRequire && codeCacheMode !== 'generate' ?
+    createRequireProfiler(__filename) : null;
+  const requireProfilerHooks = requireProfiler &&
+    installRequireProfilerHooks(requireProfiler, trampolineModule);
 
   if (usesSnapshot) {
-    innerRequire = outerRequire; // Node.js snapshots currently do not support userland require()
+    // Node.js snapshots currently do not support userland require(), so only
+    // embedded modules (and built-in ones) are available.
+    innerRequire = outerRequire;
     v8.startupSnapshot.addDeserializeCallback(() => {
       if (process.argv[1] === '--boxednode-snapshot-argv-fixup') {
         process.argv.splice(1, 1, process.execPath);
@@ -74,20 +666,149 @@ module.exports = (src, codeCacheMode, codeCache) => {
     innerRequire = Module.createRequire(__filename);
   }
 
-  function require(module) {
-    for (const [ re, linked ] of hydatedRequireMappings) {
-      try {
-        if (re.test(module))
-          return process._linkedBinding(linked);
-      } catch {}
+  // Snapshots do not support vm.compileFunction(), see below.
+  const compileEmbeddedModule = usesSnapshot ?
+    (source, filename) => (0, eval)(
+      `(function(__filename, __dirname, require, exports, module) {\n${source}\n})\n//# sourceURL=${filename}`) :
+    (source, filename) => vm.compileFunction(source, [
+      '__filename', '__dirname', 'require', 'exports', 'module'
+    ], { filename });
+  const compileModule = requireProfiler ?
+    (source, filename) => requireProfiler.compile(() => compileEmbeddedModule(source, filename)) :
+    compileEmbeddedModule;
+  const moduleGraph = moduleGraphSource ? JSON.parse(moduleGraphSource) : null;
+  const embeddedModules = moduleGraph &&
+    createEmbeddedModuleLoader(moduleGraph, __dirname, compileModule, makeRequire);
+
+  // `embeddedFrom` is the embedded file that require() calls are relative to.
+  function makeRequire(embeddedFrom) {
+    // `node` is the require profiler node for this call, or null if the
+    // profiler is disabled.
+    function load(module, node) {
+      for (const [ re, linked ] of hydatedRequireMappings) {
+        try {
+          if (re.test(module)) {
+            if (node) node.type = 'addon';
+            return process._linkedBinding(linked);
+          }
+        } catch {}
+      }
+      if (hydatedRequireMappings.length > 0 &&
+          Object.prototype.hasOwnProperty.call(linkedAddonLoaders, module)) {
+        if (node) node.type = 'addon';
+        return linkedAddonLoaders[module](
+          embeddedFrom ? embeddedModules.filename(embeddedFrom) : __filename);
+      }
+      if (!node) {
+        const embedded = embeddedModules?.resolve(module, embeddedFrom);
+        if (embedded) {
+          return embeddedModules.load(embedded);
+        }
+        return innerRequire(module);
+      }
+      const embedded = requireProfiler.resolve(() => embeddedModules?.resolve(module, embeddedFrom));
+      if (embedded) {
+        node.type = 'embedded';
+        node.filename = embeddedModules.filename(embedded);
+        node.cached = embeddedModules.isLoaded(embedded);
+        return embeddedModules.load(embedded);
+      }
+      if (isBuiltinRequest(module)) {
+        node.type = 'builtin';
+        node.filename = module;
+      } else {
+        node.type = 'file';
+      }
+      return requireProfilerHooks.forward(
+        node, () => innerRequire(module), () => innerRequire.resolve(module));
     }
-    return innerRequire(module);
+    const require = requireProfiler ?
+      function require(module) {
+        return requireProfiler.measure(module, null, (node) => load(module, node));
+      } :
+      function require(module) {
+        return load(module, null);
+      };
+    Object.defineProperties(require, Object.getOwnPropertyDescriptors(innerRequire));
+    Object.setPrototypeOf(require, Object.getPrototypeOf(innerRequire));
+    if (embeddedModules) {
+      require.resolve = (request, options) => {
+        const embedded = embeddedModules.resolve(request, embeddedFrom);
+        if (embedded) {
+          return embeddedModules.filename(embedded);
+        }
+        return innerRequire.resolve(request, options);
+      };
+    }
+    return require;
   }
-  Object.defineProperties(require, Object.getOwnPropertyDescriptors(innerRequire));
-  Object.setPrototypeOf(require, Object.getPrototypeOf(innerRequire));
+  const require = makeRequire(moduleGraph?.entry);
 
   process.argv.unshift(__filename);
-  process.boxednode = { usesSnapshot };
+  process.boxednode = { usesSnapshot, entryPoint };
+
+  let jsTimingEntries = [];
+  if (usesSnapshot) {
+    v8.startupSnapshot.addDeserializeCallback(() => {
+      jsTimingEntries = [];
+      // Modules that were loaded while building the snapshot are not recorded.
+      requireProfiler?.reset();
+    });
+  }
+  process.boxednode.markTime = (category, label) => {
+    const entry = [category, label, process.hrtime.bigint()];
+    if (trackStartupMemory) {
+      const { rss, heapTotal, heapUsed, external } = process.memoryUsage();
+      entry.push({ rss, heapTotal, heapUsed, external });
+    }
+    jsTimingEntries.push(entry);
+  };
+  const getRawTimingData = (method) => {
+    if (isBuildingSnapshot()) {
+      throw new Error(`${method}() is not available during snapshot building`);
+    }
+    return [
+      ...jsTimingEntries,
+      ...(requireProfiler ? requireProfiler.getTimingEntries() : []),
+      ...process._linkedBinding('boxednode_linked_bindings').getTimingData()
+    ].sort((a, b) => Number(a[2] - b[2]));
+  };
+  process.boxednode.getTimingData = () => {
+    const data = getRawTimingData('getTimingData');
+    // Adjust times so that process initialization happens at time 0
+    return data.map(([category, label, time, ...memory]) => [category, label, Number(time - data[0][2]), ...memory]);
+  };
+  if (requireProfiler) {
+    process.boxednode.getRequireProfile = () =>
+      requireProfiler.serialize(getRawTimingData('getRequireProfile')[0][2]);
+  }
+
+  // Runs that measure startup for the build report stop right before the
+  // application code would run, see BOXEDNODE_STARTUP_REPORT.
+  const isStartupReportRun = startupReport && codeCacheMode !== 'generate' && !usesSnapshot &&
+    process._linkedBinding('boxednode_linked_bindings').isStartupReportRun();
+
+  const runtimeCodeCache = runtimeCodeCacheKey && codeCacheMode !== 'generate' && !usesSnapshot && !isStartupReportRun ?
+    openRuntimeCodeCache(runtimeCodeCacheKey, entryPoint) : null;
+  process.boxednode.usesRuntimeCodeCache = !!runtimeCodeCache?.data;
+  if (runtimeCodeCache?.data) {
+    codeCache = runtimeCodeCache.data;
+  }
+
+  if (moduleEntryPoints.includes(entryPoint)) {
+    return runModuleEntry({
+      src,
+      filename: __filename,
+      codeCacheMode,
+      codeCache,
+      runtimeCodeCache,
+      moduleGraph,
+      embeddedModules,
+      makeRequire,
+      requireProfiler,
+      skipEvaluation: isStartupReportRun
+    });
+  }
 
   const module = {
     exports,
@@ -97,10 +818,33 @@ module.exports = (src, codeCacheMode, codeCache) => {
     path: __dirname,
     require
   };
+  embeddedModules?.setEntryModule(module);
 
   let mainFunction;
+  let rejectedCodeCache;
+  const compileStart = process.hrtime.bigint();
   if (usesSnapshot) {
     mainFunction = eval(`(function(__filename, __dirname, require, exports, module) {\n${src}\n})`);
+  } else if (runtimeCodeCacheKey) {
+    // Unlike functions from vm.compileFunction(), scripts can create code
+    // caches after they have run, which then include lazily compiled
+    // functions. The embedded code cache is created the same way, so that
+    // it stays compatible.
+    const script = new vm.Script(
+      `(function(__filename, __dirname, require, exports, module) {\n${src}\n})`, {
+        filename: __filename,
+        lineOffset: -1,
+        cachedData: codeCache.length > 0 ? codeCache : undefined
+      });
+    if (codeCacheMode === 'generate') {
+      require('fs').writeFileSync('intermediate.out', script.createCachedData());
+      return;
+    }
+    rejectedCodeCache = script.cachedDataRejected;
+    mainFunction = script.runInThisContext();
+    if (runtimeCodeCache && (!runtimeCodeCache.data || rejectedCodeCache)) {
+      runtimeCodeCache.update(() => script.createCachedData());
+    }
   } else {
     mainFunction = vm.compileFunction(src, [
       '__filename', '__dirname', 'require', 'exports', 'module'
@@ -114,33 +858,19 @@ module.exports = (src, codeCacheMode, codeCache) => {
       require('fs').writeFileSync('intermediate.out', mainFunction.cachedData);
       return;
     }
+    // https://github.com/nodejs/node/pull/46320
+    rejectedCodeCache = mainFunction.cachedDataRejected;
   }
 
   process.boxednode.hasCodeCache = codeCache.length > 0;
-  // https://github.com/nodejs/node/pull/46320
-  process.boxednode.rejectedCodeCache = mainFunction.cachedDataRejected;
-
-  let jsTimingEntries = [];
-  if (usesSnapshot) {
-    v8.startupSnapshot.addDeserializeCallback(() => {
-      jsTimingEntries = [];
-    });
+  process.boxednode.rejectedCodeCache = rejectedCodeCache;
+  if (requireProfiler) {
+    requireProfiler.root.compileTime = process.hrtime.bigint() - compileStart;
+    requireProfiler.root.codeCache = codeCache.length > 0 && !rejectedCodeCache;
   }
-  process.boxednode.markTime = (category, label) => {
-    jsTimingEntries.push([category, label, process.hrtime.bigint()]);
-  };
-  process.boxednode.getTimingData = () => {
-    if (isBuildingSnapshot()) {
-      throw new Error('getTimingData() is not available during snapshot building');
-    }
-    const data = [
-      ...jsTimingEntries,
-      ...process._linkedBinding('boxednode_linked_bindings').getTimingData()
-    ].sort((a, b) => Number(a[2] - b[2]));
-    // Adjust times so that process initialization happens at time 0
-    return data.map(([category, label, time]) => [category, label, Number(time - data[0][2])]);
-  };
 
+  if (isStartupReportRun) return;
   mainFunction(__filename, __dirname, require, exports, module);
+  requireProfiler?.finish();
   return module.exports;
 };
@@ -7,6 +7,7 @@
 #include "node_api.h"
 #include "uv.h"
 #include "brotli/decode.h"
+#include <algorithm>
 #include <atomic>
 #if HAVE_OPENSSL
 #include <openssl/err.h>
@@ -19,6 +20,10 @@
 #endif
 #include <type_traits> // injected code may refer to std::underlying_type
 #include <optional>
+#include <string>
+#if defined(BOXEDNODE_CACHE_DECOMPRESSED_BLOBS) && !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 using namespace node;
 using namespace v8;
@@ -57,6 +62,24 @@ using namespace v8;
 #define PASS_NO_NODE_SNAPSHOT_OPTION 1
 #endif
 
+// Snapshots are always consumed from the embedded blob, and code caches only
+// when one was generated at build time. Shared library instances decode the
+// blobs when they are created instead.
+#if (defined(BOXEDNODE_CONSUME_SNAPSHOT) && !defined(BOXEDNODE_LIBRARY)) || \
+    defined(BOXEDNODE_PREFETCH_CODE_CACHE)
+#define BOXEDNODE_PREFETCH_BLOBS 1
+#endif
+
+// Shared library builds rely on node::InitializeOncePerProcess().
+#if defined(BOXEDNODE_LIBRARY) && defined(USE_OWN_LEGACY_PROCESS_INITIALIZATION)
+#error "Shared library builds require Node.js 18.11.0 or newer"
+#endif
+
+// Identifies the embedded sources for runtime code cache files, if enabled.
+#ifndef BOXEDNODE_RUNTIME_CODE_CACHE_KEY
+#define BOXEDNODE_RUNTIME_CODE_CACHE_KEY ""
+#endif
+
 #ifdef USE_OWN_LEGACY_PROCESS_INITIALIZATION
 namespace boxednode {
 void InitializeOncePerProcess();
@@ -65,11 +88,26 @@ void TearDownOncePerProcess();
 #endif
 namespace boxednode {
 namespace {
+#ifdef BOXEDNODE_TRACK_STARTUP_MEMORY
+// Matches the fields of process.memoryUsage(). Heap statistics are only
+// available for marks that are recorded once the Isolate has been entered.
+struct MemoryUsage {
+  size_t rss = 0;
+  bool has_heap_statistics = false;
+  size_t heap_total = 0;
+  size_t heap_used = 0;
+  size_t external = 0;
+};
+#endif
+
 struct TimingEntry {
   const char* const category;
   const char* const label;
   uint64_t const time;
   TimingEntry* next = nullptr;
+#ifdef BOXEDNODE_TRACK_STARTUP_MEMORY
+  std::optional<MemoryUsage> memory;
+#endif
   ~TimingEntry() {
     delete next;
   }
@@ -77,44 +115,552 @@ struct TimingEntry {
 TimingEntry start_time_entry { "Node.js Instance", "Process initialization", uv_hrtime() };
 std::atomic<TimingEntry*> current_time_entry { &start_time_entry };
 
-void MarkTime(const char* category, const char* label) {
+void MarkTime(const char* category, const char* label, Isolate* isolate = nullptr) {
   TimingEntry* new_entry = new TimingEntry {category, label, uv_hrtime() };
+#ifdef BOXEDNODE_TRACK_STARTUP_MEMORY
+  MemoryUsage memory;
+  uv_resident_set_memory(&memory.rss);
+  if (isolate != nullptr) {
+    HeapStatistics stats;
+    isolate->GetHeapStatistics(&stats);
+    memory.has_heap_statistics = true;
+    memory.heap_total = stats.total_heap_size();
+    memory.heap_used = stats.used_heap_size();
+    memory.external = stats.external_memory();
+  }
+  new_entry->memory = memory;
+#endif
   do {
     new_entry->next = current_time_entry.load();
   } while(!current_time_entry.compare_exchange_strong(new_entry->next, new_entry));
 }
+
+#ifdef BOXEDNODE_LIBRARY
+// Drops all marks except for process initialization, so that the timing data
+// of each run does not accumulate.
+void ResetTimingData() {
+  TimingEntry* head = current_time_entry.exchange(&start_time_entry);
+  while (head != &start_time_entry) {
+    TimingEntry* next = head->next;
+    head->next = nullptr;
+    delete head;
+    head = next;
+  }
+}
+#endif
+
+#ifdef BOXEDNODE_CACHE_DECOMPRESSED_BLOBS
+// Describes a compressed blob whose decompressed contents can be stored in
+// and mapped from the per-user blob cache directory.
+struct DecompressedBlobCacheEntry {
+  const char* file_name; // Contains a hash of the compressed blob
+  size_t size;
+  uint32_t checksum[4]; // See BlobChecksum()
+  void (*read)(char* dst);
+  const char* hit_label;
+  const char* miss_label;
+};
+
+#ifdef _WIN32
+constexpr char kPathSeparator = '\\';
+#else
+constexpr char kPathSeparator = '/';
+#endif
+
+std::optional<std::string> GetEnvVar(const char* name) {
+  char buf[4096];
+  size_t len = sizeof(buf);
+  if (uv_os_getenv(name, buf, &len) != 0 || len == 0) return {};
+  return std::string(buf, len);
+}
+
+bool EnsureDirectory(const std::string& dir) {
+  uv_fs_t req;
+  int err = uv_fs_mkdir(nullptr, &req, dir.c_str(), 0700, nullptr);
+  uv_fs_req_cleanup(&req);
+  return err == 0 || err == UV_EEXIST;
+}
+
+// Returns an empty string if no usable cache directory could be determined.
+// BOXEDNODE_BLOB_CACHE_DIR overrides the platform default.
+std::string GetBlobCacheDirectory() {
+  if (auto dir = GetEnvVar("BOXEDNODE_BLOB_CACHE_DIR")) {
+    return EnsureDirectory(*dir) ? *dir : std::string();
+  }
+  std::string base;
+#ifdef _WIN32
+  base = GetEnvVar("LOCALAPPDATA").value_or("");
+#else
+  char home[4096];
+  size_t home_len = sizeof(home);
+  if (uv_os_homedir(home, &home_len) == 0) base = std::string(home, home_len);
+#ifdef __APPLE__
+  if (!base.empty()) base += "/Library/Caches";
+#else
+  if (auto xdg = GetEnvVar("XDG_CACHE_HOME")) {
+    base = *xdg;
+  } else if (!base.empty()) {
+    base += "/.cache";
+  }
+#endif
+#endif
+  if (base.empty() || !EnsureDirectory(base)) return {};
+  std::string dir = base + kPathSeparator + "boxednode";
+  return EnsureDirectory(dir) ? dir : std::string();
+}
+
+// A cheap checksum of the decompressed blob contents, which detects cache
+// files that were truncated or corrupted, but not deliberately forged ones.
+// Must match blobChecksum() in src/helpers.ts: four lanes of 32-bit
+// little-endian words, each updated as `lane = (lane ^ word) * prime`, with
+// the trailing bytes folded into the first lane.
+void BlobChecksum(const char* data, size_t size, uint32_t checksum[4]) {
+  constexpr uint32_t kPrime = 0x9e3779b1;
+  uint32_t lanes[4] = { 0x811c9dc5, 0x01000193, 0xcc9e2d51, 0x1b873593 };
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  const size_t blocks = size / 16;
+  for (size_t i = 0; i < blocks; i++, p += 16) {
+    for (int lane = 0; lane < 4; lane++) {
+      const unsigned char* w = p + lane * 4;
+      const uint32_t word = w[0] | (w[1] << 8) | (w[2] << 16) | (static_cast<uint32_t>(w[3]) << 24);
+      lanes[lane] = (lanes[lane] ^ word) * kPrime;
+    }
+  }
+  for (size_t i = blocks * 16; i < size; i++, p++) {
+    lanes[0] = (lanes[0] ^ *p) * kPrime;
+  }
+  memcpy(checksum, lanes, sizeof(lanes));
+}
+
+// Cache files start with this header, followed by the decompressed blob.
+// Its size keeps the blob contents aligned.
+struct BlobCacheFileHeader {
+  char magic[8];
+  uint64_t size;
+  uint32_t checksum[4];
+  char padding[32];
+};
+static_assert(sizeof(BlobCacheFileHeader) == 64, "Unexpected blob cache header size");
+constexpr char kBlobCacheFileMagic[8] = { 'B', 'X', 'N', 'D', 'B', 'L', 'O', 'B' };
+
+bool IsValidBlobCacheFile(const char* file, const DecompressedBlobCacheEntry& entry) {
+  BlobCacheFileHeader header;
+  memcpy(&header, file, sizeof(header));
+  if (memcmp(header.magic, kBlobCacheFileMagic, sizeof(header.magic)) != 0 ||
+      header.size != entry.size ||
+      memcmp(header.checksum, entry.checksum, sizeof(header.checksum)) != 0) {
+    return false;
+  }
+  uint32_t checksum[4];
+  BlobChecksum(file + sizeof(header), entry.size, checksum);
+  return memcmp(checksum, entry.checksum, sizeof(checksum)) == 0;
+}
+
+// Maps a cache file privately (copy-on-write) into memory and returns the
+// blob contents, or nullptr if the file is missing or does not match the
+// entry. The mapping is never released, as it is used for the lifetime of
+// the process.
+char* MapBlobCacheFile(const std::string& path, const DecompressedBlobCacheEntry& entry) {
+  const size_t file_size = sizeof(BlobCacheFileHeader) + entry.size;
+  uv_fs_t req;
+  uv_file fd = uv_fs_open(nullptr, &req, path.c_str(), UV_FS_O_RDONLY, 0, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0) return nullptr;
+  char* file = nullptr;
+  if (uv_fs_fstat(nullptr, &req, fd, nullptr) == 0 &&
+      req.statbuf.st_size == file_size) {
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingW(
+        reinterpret_cast<HANDLE>(uv_get_osfhandle(fd)),
+        nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+      file = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, file_size));
+      CloseHandle(mapping); // The view keeps the mapping alive.
+    }
+#else
+    void* addr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) file = static_cast<char*>(addr);
+#endif
+  }
+  uv_fs_req_cleanup(&req);
+  uv_fs_close(nullptr, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (file != nullptr && !IsValidBlobCacheFile(file, entry)) {
+#ifdef _WIN32
+    UnmapViewOfFile(file);
+#else
+    munmap(file, file_size);
+#endif
+    return nullptr;
+  }
+  return file != nullptr ? file + sizeof(BlobCacheFileHeader) : nullptr;
+}
+
+// Decodes the blob into a temporary file next to `path` and atomically
+// renames it into place, so that concurrently starting processes never see
+// partially written cache files.
+bool PopulateBlobCacheFile(const std::string& path,
+                           const DecompressedBlobCacheEntry& entry) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%d.tmp", static_cast<int>(uv_os_getpid()));
+  const std::string tmp_path = path + suffix;
+
+  uv_fs_t req;
+  // Opening the file first means that read-only cache directories do not
+  // cost us an extra decode before falling back to in-memory decoding.
+  uv_file fd = uv_fs_open(nullptr, &req, tmp_path.c_str(),
+      UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0600, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0) return false;
+
+  BlobCacheFileHeader header = {};
+  memcpy(header.magic, kBlobCacheFileMagic, sizeof(header.magic));
+  header.size = entry.size;
+  memcpy(header.checksum, entry.checksum, sizeof(header.checksum));
+  std::vector<char> decoded(sizeof(header) + entry.size);
+  memcpy(decoded.data(), &header, sizeof(header));
+  entry.read(decoded.data() + sizeof(header));
+  MarkTime("Boxednode Blob Cache", "Decoded blob for cache");
+
+  bool ok = true;
+  size_t written = 0;
+  while (ok && written < decoded.size()) {
+    uv_buf_t buf = uv_buf_init(
+        decoded.data() + written,
+        static_cast<unsigned int>(std::min<size_t>(decoded.size() - written, 1 << 30)));
+    int ret = uv_fs_write(nullptr, &req, fd, &buf, 1, -1, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (ret <= 0) ok = false;
+    else written += ret;
+  }
+  ok = ok && uv_fs_fsync(nullptr, &req, fd, nullptr) == 0;
+  uv_fs_req_cleanup(&req);
+  uv_fs_close(nullptr, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+  ok = ok && uv_fs_rename(nullptr, &req, tmp_path.c_str(), path.c_str(), nullptr) == 0;
+  uv_fs_req_cleanup(&req);
+  if (!ok) {
+    uv_fs_unlink(nullptr, &req, tmp_path.c_str(), nullptr);
+    uv_fs_req_cleanup(&req);
+  }
+  return ok;
+}
+
+// Returns the decompressed blob contents mapped from the cache directory,
+// populating the cache first if necessary, or nullptr if the cache cannot be
+// used. Callers fall back to decoding the embedded blob in the latter case.
+char* GetCachedDecompressedBlob(const DecompressedBlobCacheEntry& entry) {
+  const std::string dir = GetBlobCacheDirectory();
+  if (dir.empty()) {
+    MarkTime("Boxednode Blob Cache", "Cache unavailable");
+    return nullptr;
+  }
+  const std::string path = dir + kPathSeparator + entry.file_name;
+  // Files that fail verification are treated as misses and replaced.
+  if (char* data = MapBlobCacheFile(path, entry)) {
+    MarkTime("Boxednode Blob Cache", entry.hit_label);
+    return data;
+  }
+  MarkTime("Boxednode Blob Cache", entry.miss_label);
+  if (!PopulateBlobCacheFile(path, entry)) {
+    MarkTime("Boxednode Blob Cache", "Cache unavailable");
+    return nullptr;
+  }
+  return MapBlobCacheFile(path, entry);
+}
+#endif // BOXEDNODE_CACHE_DECOMPRESSED_BLOBS
 } // anonymous namespace
 
-Local<String> GetBoxednodeMainScriptSource(Isolate* isolate);
-Local<Uint8Array> GetBoxednodeCodeCacheBuffer(Isolate* isolate);
-std::vector<char> GetBoxednodeSnapshotBlobVector();
+Local<String> GetBoxednodeMainScriptSource(size_t entry_point, Isolate* isolate);
+Local<String> GetBoxednodeModuleGraphSource(size_t entry_point, Isolate* isolate);
+Local<Uint8Array> GetBoxednodeCodeCacheBuffer(size_t entry_point, Isolate* isolate);
+std::vector<char> GetBoxednodeSnapshotBlobVector(size_t entry_point);
 #ifdef NODE_VERSION_SUPPORTS_STRING_VIEW_SNAPSHOT
-std::optional<std::string_view> GetBoxednodeSnapshotBlobSV();
+std::optional<std::string_view> GetBoxednodeSnapshotBlobSV(size_t entry_point);
 #endif
+std::shared_ptr<BackingStore> GetBoxednodeCodeCacheBackingStore(size_t entry_point);
+
+// The entry points that are embedded into the binary. The first one is the
+// default entry point and has an empty name. All of the accessors above
+// return the data for the entry point with the given index.
+extern const char* const kBoxednodeEntryPointNames[];
+extern const size_t kBoxednodeEntryPointCount;
+
+namespace {
+#ifndef BOXEDNODE_LIBRARY
+// Executables run a single entry point per process. Shared library
+// instances keep track of their own entry point instead.
+size_t selected_entry_point = 0;
+
+std::string GetExecutableName(std::string path) {
+#ifdef _WIN32
+  size_t separator = path.find_last_of("/\\");
+#else
+  size_t separator = path.find_last_of('/');
+#endif
+  if (separator != std::string::npos) path = path.substr(separator + 1);
+#ifdef _WIN32
+  if (path.size() > 4) {
+    std::string extension = path.substr(path.size() - 4);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == ".exe") path.resize(path.size() - 4);
+  }
+#endif
+  return path;
+}
+
+// Like busybox, binaries with multiple entry points run the one that matches
+// the executable name (e.g. when invoked through a symlink or a copy), or
+// the one named by the first argument, which is then removed from argv.
+// Otherwise, the default entry point is used.
+void SelectEntryPoint(std::vector<std::string>* args) {
+  if (kBoxednodeEntryPointCount <= 1 || args->empty()) return;
+  const std::string executable_name = GetExecutableName((*args)[0]);
+  for (size_t i = 1; i < kBoxednodeEntryPointCount; i++) {
+    if (executable_name == kBoxednodeEntryPointNames[i]) {
+      selected_entry_point = i;
+      return;
+    }
+  }
+  if (args->size() < 2) return;
+  for (size_t i = 1; i < kBoxednodeEntryPointCount; i++) {
+    if ((*args)[1] == kBoxednodeEntryPointNames[i]) {
+      selected_entry_point = i;
+      args->erase(args->begin() + 1);
+      return;
+    }
+  }
+}
+#else
+// Shared library instances select entry points by name, with the default
+// entry point being the one without a name.
+std::optional<size_t> FindEntryPoint(const char* name) {
+  if (name == nullptr || name[0] == '\0') return 0;
+  for (size_t i = 1; i < kBoxednodeEntryPointCount; i++) {
+    if (strcmp(name, kBoxednodeEntryPointNames[i]) == 0) return i;
+  }
+  return {};
+}
+#endif // BOXEDNODE_LIBRARY
+} // anonymous namespace
+
+#ifdef BOXEDNODE_OPENSSL_DEFAULTS
+namespace {
+// Node.js does not initialize OpenSSL in this mode, so it would silently
+// ignore the environment variables and options that configure it. Refuse to
+// start instead. `node_args` are the Node.js options passed directly, in
+// addition to those from NODE_OPTIONS.
+bool CheckOpenSSLDefaults(const char* argv0,
+                          const std::vector<std::string>& node_args) {
+  static const char* const kEnvVars[] = {
+    "OPENSSL_CONF", "NODE_EXTRA_CA_CERTS"
+  };
+  static const char* const kOptions[] = {
+    "--openssl-config", "--openssl-legacy-provider",
+    "--openssl-shared-config", "--enable-fips", "--force-fips"
+  };
+  std::string unsupported;
+  for (const char* env_var : kEnvVars) {
+    const char* value = getenv(env_var);
+    if (value != nullptr && value[0] != '\0') {
+      unsupported = env_var;
+      break;
+    }
+  }
+  std::vector<std::string> options = node_args;
+  if (const char* node_options = getenv("NODE_OPTIONS")) {
+    // Only option names are compared, so splitting on whitespace is enough.
+    std::string current;
+    for (const char* c = node_options;; c++) {
+      if (*c == '\0' || *c == ' ' || *c == '\t') {
+        if (!current.empty()) options.push_back(current);
+        current.clear();
+        if (*c == '\0') break;
+      } else {
+        current += *c;
+      }
+    }
+  }
+  for (const std::string& option : options) {
+    if (!unsupported.empty()) break;
+    if (option == "--") break;
+    for (const char* name : kOptions) {
+      if (option.compare(0, option.find('='), name) == 0) {
+        unsupported = name;
+        break;
+      }
+    }
+  }
+  if (unsupported.empty()) return true;
+  fprintf(stderr,
+          "%s: %s is not supported, since this binary uses the default "
+          "OpenSSL configuration\n",
+          argv0, unsupported.c_str());
+  return false;
+}
+} // anonymous namespace
+#endif // BOXEDNODE_OPENSSL_DEFAULTS
+
+#ifdef BOXEDNODE_PREFETCH_BLOBS
+namespace {
+// Decoding the embedded blobs (i.e. decompressing them, or reading them from
+// the decompressed blob cache) does not depend on V8, so it is started on a
+// background thread and overlaps with V8 initialization. The thread is only
+// started once InitializeOncePerProcess() has set up stdio, since it may open
+// files, which could otherwise take over closed stdio file descriptors. The
+// thread is joined right before the Isolate is created.
+struct PrefetchedBlobs {
+  uv_thread_t thread;
+  bool started = false;
+#ifdef BOXEDNODE_CONSUME_SNAPSHOT
+  std::optional<std::string_view> snapshot_sv;
+  std::vector<char> snapshot_vector;
+#endif
+#ifdef BOXEDNODE_PREFETCH_CODE_CACHE
+  std::shared_ptr<BackingStore> code_cache;
+#endif
+};
+PrefetchedBlobs prefetched_blobs;
+
+void PrefetchBlobs(void* data) {
+  PrefetchedBlobs* blobs = static_cast<PrefetchedBlobs*>(data);
+  MarkTime("Boxednode Blob Prefetch", "Started decoding blobs");
+#ifdef BOXEDNODE_CONSUME_SNAPSHOT
+#ifdef NODE_VERSION_SUPPORTS_STRING_VIEW_SNAPSHOT
+  blobs->snapshot_sv = GetBoxednodeSnapshotBlobSV(selected_entry_point);
+  if (!blobs->snapshot_sv)
+#endif
+    blobs->snapshot_vector = GetBoxednodeSnapshotBlobVector(selected_entry_point);
+  MarkTime("Boxednode Blob Prefetch", "Decoded snapshot");
+#endif
+#ifdef BOXEDNODE_PREFETCH_CODE_CACHE
+  blobs->code_cache = GetBoxednodeCodeCacheBackingStore(selected_entry_point);
+  MarkTime("Boxednode Blob Prefetch", "Decoded code cache");
+#endif
+}
+
+void StartBlobPrefetch() {
+  prefetched_blobs.started =
+      uv_thread_create(&prefetched_blobs.thread, PrefetchBlobs, &prefetched_blobs) == 0;
+}
+
+// Falls back to decoding the blobs synchronously if the thread could not
+// be started.
+void JoinBlobPrefetch() {
+  if (prefetched_blobs.started) {
+    int err = uv_thread_join(&prefetched_blobs.thread);
+    assert(err == 0);
+    prefetched_blobs.started = false;
+  } else {
+    PrefetchBlobs(&prefetched_blobs);
+  }
+  MarkTime("Node.js Instance", "Joined blob prefetch thread");
+}
+} // anonymous namespace
+#endif // BOXEDNODE_PREFETCH_BLOBS
 
 void GetTimingData(const FunctionCallbackInfo<Value>& info) {
   Isolate* isolate = info.GetIsolate();
   TimingEntry* head = current_time_entry.load();
   std::vector<Local<Value>> entries;
   while (head != nullptr) {
-    Local<Value> elements[] = {
+    std::vector<Local<Value>> elements = {
       String::NewFromUtf8(isolate, head->category).ToLocalChecked(),
       String::NewFromUtf8(isolate, head->label).ToLocalChecked(),
       BigInt::NewFromUnsigned(isolate, head->time)
     };
-    entries.push_back(Array::New(isolate, elements, sizeof(elements)/sizeof(elements[0])));
+#ifdef BOXEDNODE_TRACK_STARTUP_MEMORY
+    if (head->memory) {
+      Local<Context> context = isolate->GetCurrentContext();
+      Local<Object> memory = Object::New(isolate);
+      auto set = [&](const char* key, size_t value) {
+        memory->Set(
+            context,
+            String::NewFromUtf8(isolate, key).ToLocalChecked(),
+            Number::New(isolate, static_cast<double>(value))).Check();
+      };
+      set("rss", head->memory->rss);
+      if (head->memory->has_heap_statistics) {
+        set("heapTotal", head->memory->heap_total);
+        set("heapUsed", head->memory->heap_used);
+        set("external", head->memory->external);
+      }
+      elements.push_back(memory);
+    }
+#endif
+    entries.push_back(Array::New(isolate, elements.data(), elements.size()));
     head = head->next;
   }
   Local<Array> retval = Array::New(isolate, entries.data(), entries.size());
   info.GetReturnValue().Set(retval);
 }
 
+#if defined(BOXEDNODE_STARTUP_REPORT) && !defined(BOXEDNODE_LIBRARY)
+// Returns the file that BOXEDNODE_STARTUP_REPORT_FILE points to, or an empty
+// string. Startup report runs also require BOXEDNODE_STARTUP_REPORT_NONCE to
+// match the random nonce that was generated for this build, so that they
+// cannot be triggered by the environment of the binary's users.
+const std::string& GetStartupReportFile() {
+  static const std::string file = []() -> std::string {
+    char value[4096];
+    size_t len = sizeof(value);
+    if (uv_os_getenv("BOXEDNODE_STARTUP_REPORT_NONCE", value, &len) != 0 ||
+        std::string(value, len) != BOXEDNODE_STARTUP_REPORT_NONCE) {
+      return {};
+    }
+    len = sizeof(value);
+    if (uv_os_getenv("BOXEDNODE_STARTUP_REPORT_FILE", value, &len) != 0) {
+      return {};
+    }
+    return std::string(value, len);
+  }();
+  return file;
+}
+
+void IsStartupReportRun(const FunctionCallbackInfo<Value>& info) {
+  info.GetReturnValue().Set(!GetStartupReportFile().empty());
+}
+
+// For startup report runs, writes the timing data recorded so far to the
+// report file as a JSON array of [category, label, ns] entries, with times
+// relative to process initialization, and returns true. The build report
+// uses this to attribute startup time to embedded components.
+bool WriteStartupReport() {
+  const std::string& path = GetStartupReportFile();
+  if (path.empty()) return false;
+  std::vector<const TimingEntry*> entries;
+  for (TimingEntry* head = current_time_entry.load(); head != nullptr; head = head->next)
+    entries.push_back(head);
+  std::reverse(entries.begin(), entries.end());
+  FILE* fp = fopen(path.c_str(), "w");
+  if (fp == nullptr) {
+    fprintf(stderr, "Failed to open startup report file %s\n", path.c_str());
+    return true;
+  }
+  fprintf(fp, "[");
+  for (size_t i = 0; i < entries.size(); i++) {
+    // Categories and labels are string literals that need no escaping.
+    fprintf(fp, "%s\n  [\"%s\", \"%s\", %llu]",
+            i > 0 ? "," : "",
+            entries[i]->category,
+            entries[i]->label,
+            static_cast<unsigned long long>(entries[i]->time - start_time_entry.time));
+  }
+  fprintf(fp, "\n]\n");
+  fclose(fp);
+  return true;
+}
+#endif
+
 void boxednode_linked_bindings_register(
     Local<Object> exports,
     Local<Value> module,
     Local<Context> context,
     void* priv) {
   NODE_SET_METHOD(exports, "getTimingData", GetTimingData);
+#if defined(BOXEDNODE_STARTUP_REPORT) && !defined(BOXEDNODE_LIBRARY)
+  NODE_SET_METHOD(exports, "isStartupReportRun", IsStartupReportRun);
+#endif
 }
 
 }
@@ -133,7 +679,8 @@ static register_boxednode_linked_module boxednode_linked_modules[] = {
   nullptr  // Make sure the array is not empty, for MSVC
 };
 
-static MaybeLocal<Value> LoadBoxednodeEnvironment(Local<Context> context) {
+static MaybeLocal<Value> LoadBoxednodeEnvironment(Local<Context> context,
+                                                  size_t entry_point) {
   Environment* env = GetCurrentEnvironment(context);
   return LoadEnvironment(env,
 #ifdef BOXEDNODE_CONSUME_SNAPSHOT
@@ -156,12 +703,31 @@ static MaybeLocal<Value> LoadBoxednodeEnvironment(Local<Context> context) {
             return {}; // JS exception.
           }
           assert(entrypoint_ret->IsFunction());
+          Local<Value> main_script_source =
+              boxednode::GetBoxednodeMainScriptSource(entry_point, isolate);
+          boxednode::MarkTime("Node.js Instance", "Created main script source", isolate);
+#ifdef BOXEDNODE_PREFETCH_CODE_CACHE
+          Local<SharedArrayBuffer> code_cache_array_buffer = SharedArrayBuffer::New(
+              isolate, std::move(boxednode::prefetched_blobs.code_cache));
+          Local<Value> code_cache_buffer = Uint8Array::New(
+              code_cache_array_buffer, 0, code_cache_array_buffer->ByteLength());
+#else
+          Local<Value> code_cache_buffer =
+              boxednode::GetBoxednodeCodeCacheBuffer(entry_point, isolate);
+#endif
+          boxednode::MarkTime("Node.js Instance", "Read code cache", isolate);
           Local<Value> trampoline_args[] = {
-            boxednode::GetBoxednodeMainScriptSource(isolate),
+            main_script_source,
             String::NewFromUtf8Literal(isolate, BOXEDNODE_CODE_CACHE_MODE),
-            boxednode::GetBoxednodeCodeCacheBuffer(isolate),
+            code_cache_buffer,
+            boxednode::GetBoxednodeModuleGraphSource(entry_point, isolate),
+            String::NewFromUtf8(
+                isolate,
+                boxednode::kBoxednodeEntryPointNames[entry_point])
+                .ToLocalChecked(),
+            String::NewFromUtf8Literal(isolate, BOXEDNODE_RUNTIME_CODE_CACHE_KEY),
           };
-          boxednode::MarkTime("Node.js Instance", "Calling entrypoint");
+          boxednode::MarkTime("Node.js Instance", "Calling entrypoint", isolate);
           if (entrypoint_ret.As<Function>()->Call(
               context,
               Null(isolate),
@@ -169,7 +735,7 @@ static MaybeLocal<Value> LoadBoxednodeEnvironment(Local<Context> context) {
               trampoline_args).IsEmpty()) {
             return {}; // JS exception.
           }
-          boxednode::MarkTime("Node.js Instance", "Called entrypoint");
+          boxednode::MarkTime("Node.js Instance", "Called entrypoint", isolate);
           return Null(isolate);
       }
 #endif
@@ -202,7 +768,7 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
     HandleScope handle_scope(isolate);
     Local<Context> context = setup->context();
     Context::Scope context_scope(context);
-    if (LoadBoxednodeEnvironment(context).IsEmpty())
+    if (LoadBoxednodeEnvironment(context, boxednode::selected_entry_point).IsEmpty())
       return 1;
     exit_code = SpinEventLoop(setup->env()).FromMaybe(1);
   }
@@ -215,6 +781,47 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
   return exit_code;
 }
 #else // BOXEDNODE_GENERATE_SNAPSHOT
+static void AddBoxednodeLinkedBindings(Environment* env) {
+  const void* node_mod;
+  const void* napi_mod;
+
+  for (register_boxednode_linked_module reg : boxednode_linked_modules) {
+    if (reg == nullptr) continue;
+    node_mod = nullptr;
+    napi_mod = nullptr;
+    reg(&node_mod, &napi_mod);
+    if (node_mod != nullptr)
+      AddLinkedBinding(env, *static_cast<const node_module*>(node_mod));
+#if NODE_VERSION_AT_LEAST(14, 13, 0)
+    if (napi_mod != nullptr)
+      AddLinkedBinding(env, *static_cast<const napi_module*>(napi_mod));
+#endif
+  }
+  AddLinkedBinding(
+      env,
+      "boxednode_linked_bindings",
+      boxednode::boxednode_linked_bindings_register, nullptr);
+}
+
+static void DisposeBoxednodeIsolate(MultiIsolatePlatform* platform,
+                                    Isolate* isolate,
+                                    uv_loop_t* loop) {
+  // Unregister the Isolate with the platform and add a listener that is called
+  // when the Platform is done cleaning up any state it had associated with
+  // the Isolate.
+  bool platform_finished = false;
+  platform->AddIsolateFinishedCallback(isolate, [](void* data) {
+    *static_cast<bool*>(data) = true;
+  }, &platform_finished);
+  platform->UnregisterIsolate(isolate);
+  isolate->Dispose();
+
+  // Wait until the platform has cleaned up all relevant resources.
+  while (!platform_finished)
+    uv_run(loop, UV_RUN_ONCE);
+}
+
+#ifndef BOXEDNODE_LIBRARY
 static int RunNodeInstance(MultiIsolatePlatform* platform,
                            const std::vector<std::string>& args,
                            const std::vector<std::string>& exec_args) {
@@ -239,18 +846,23 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
   std::shared_ptr<ArrayBufferAllocator> allocator =
       ArrayBufferAllocator::Create();
 
+#ifdef BOXEDNODE_PREFETCH_BLOBS
+  boxednode::JoinBlobPrefetch();
+#endif
+
 #ifdef BOXEDNODE_CONSUME_SNAPSHOT
   assert(EmbedderSnapshotData::CanUseCustomSnapshotPerIsolate());
+  auto& prefetched_blobs = boxednode::prefetched_blobs;
   node::EmbedderSnapshotData::Pointer snapshot_blob;
 #ifdef NODE_VERSION_SUPPORTS_STRING_VIEW_SNAPSHOT
-  if (const auto snapshot_blob_sv = boxednode::GetBoxednodeSnapshotBlobSV()) {
-    snapshot_blob = EmbedderSnapshotData::FromBlob(snapshot_blob_sv.value());
+  if (prefetched_blobs.snapshot_sv) {
+    snapshot_blob = EmbedderSnapshotData::FromBlob(prefetched_blobs.snapshot_sv.value());
   }
 #endif
   if (!snapshot_blob) {
-    std::vector<char> snapshot_blob_vec = boxednode::GetBoxednodeSnapshotBlobVector();
-    boxednode::MarkTime("Node.js Instance", "Decoded snapshot");
-    snapshot_blob = EmbedderSnapshotData::FromBlob(snapshot_blob_vec);
+    snapshot_blob = EmbedderSnapshotData::FromBlob(prefetched_blobs.snapshot_vector);
+    // The decoded blob is not needed once it has been deserialized.
+    std::vector<char>().swap(prefetched_blobs.snapshot_vector);
   }
   boxednode::MarkTime("Node.js Instance", "Read snapshot");
   Isolate* isolate = NewIsolate(allocator, loop, platform, snapshot_blob.get());
@@ -279,7 +891,7 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
         ),
         node::FreeIsolateData);
 
-    boxednode::MarkTime("Node.js Instance", "Created IsolateData");
+    boxednode::MarkTime("Node.js Instance", "Created IsolateData", isolate);
     HandleScope handle_scope(isolate);
     Local<Context> context;
 #ifndef BOXEDNODE_CONSUME_SNAPSHOT
@@ -295,7 +907,7 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
     // node::LoadEnvironment() are being called.
     Context::Scope context_scope(context);
 #endif
-    boxednode::MarkTime("Node.js Instance", "Created Context");
+    boxednode::MarkTime("Node.js Instance", "Created Context", isolate);
 
     // Create a node::Environment instance that will later be released using
     // node::FreeEnvironment().
@@ -309,28 +921,14 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
     Context::Scope context_scope(context);
 #endif
     assert(isolate->InContext());
-    boxednode::MarkTime("Node.js Instance", "Created Environment");
-
-    const void* node_mod;
-    const void* napi_mod;
-
-    for (register_boxednode_linked_module reg : boxednode_linked_modules) {
-      if (reg == nullptr) continue;
-      node_mod = nullptr;
-      napi_mod = nullptr;
-      reg(&node_mod, &napi_mod);
-      if (node_mod != nullptr)
-        AddLinkedBinding(env.get(), *static_cast<const node_module*>(node_mod));
-#if NODE_VERSION_AT_LEAST(14, 13, 0)
-      if (napi_mod != nullptr)
-        AddLinkedBinding(env.get(), *static_cast<const napi_module*>(napi_mod));
-#endif
-    }
-    AddLinkedBinding(
-        env.get(),
-        "boxednode_linked_bindings",
-        boxednode::boxednode_linked_bindings_register, nullptr);
-    boxednode::MarkTime("Boxednode Binding", "Added bindings");
+    boxednode::MarkTime("Node.js Instance", "Created Environment", isolate);
+
+    AddBoxednodeLinkedBindings(env.get());
+    boxednode::MarkTime("Boxednode Binding", "Added bindings", isolate);
+
+    // Startup report runs stop before running the application code, and
+    // then skip the event loop, but still clean up as usual.
+    bool wrote_startup_report = false;
 
     // Set up the Node.js instance for execution, and run code inside of it.
     // There is also a variant that takes a callback and provides it with
@@ -341,39 +939,51 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
     // `module.createRequire()` is being used to create one that is able to
     // load files from the disk, and uses the standard CommonJS file loader
     // instead of the internal-only `require` function.
-    if (LoadBoxednodeEnvironment(context).IsEmpty()) {
-      return 1; // There has been a JS exception.
-    }
-    boxednode::MarkTime("Boxednode Binding", "Loaded Environment, entering loop");
-
-    {
-      // SealHandleScope protects against handle leaks from callbacks.
-      SealHandleScope seal(isolate);
-      bool more;
-      do {
-        uv_run(loop, UV_RUN_DEFAULT);
-
-        // V8 tasks on background threads may end up scheduling new tasks in the
-        // foreground, which in turn can keep the event loop going. For example,
-        // WebAssembly.compile() may do so.
-        platform->DrainTasks(isolate);
-
-        // If there are new tasks, continue.
-        more = uv_loop_alive(loop);
-        if (more) continue;
-
-        // node::EmitBeforeExit() is used to emit the 'beforeExit' event on
-        // the `process` object.
-        node::EmitBeforeExit(env.get());
-
-        // 'beforeExit' can also schedule new work that keeps the event loop
-        // running.
-        more = uv_loop_alive(loop);
-      } while (more == true);
+#if defined(BOXEDNODE_STARTUP_REPORT) && defined(BOXEDNODE_CONSUME_SNAPSHOT)
+    // The snapshot's main function runs the application code right away.
+    wrote_startup_report = boxednode::WriteStartupReport();
+#endif
+    if (!wrote_startup_report) {
+      if (LoadBoxednodeEnvironment(context, boxednode::selected_entry_point).IsEmpty()) {
+        return 1; // There has been a JS exception.
+      }
+      boxednode::MarkTime("Boxednode Binding", "Loaded Environment, entering loop", isolate);
+#if defined(BOXEDNODE_STARTUP_REPORT) && !defined(BOXEDNODE_CONSUME_SNAPSHOT)
+      // The trampoline skips running the application code in this case.
+      wrote_startup_report = boxednode::WriteStartupReport();
+#endif
     }
 
-    // node::EmitExit() returns the current exit code.
-    exit_code = node::EmitExit(env.get());
+    if (!wrote_startup_report) {
+      {
+        // SealHandleScope protects against handle leaks from callbacks.
+        SealHandleScope seal(isolate);
+        bool more;
+        do {
+          uv_run(loop, UV_RUN_DEFAULT);
+
+          // V8 tasks on background threads may end up scheduling new tasks in the
+          // foreground, which in turn can keep the event loop going. For example,
+          // WebAssembly.compile() may do so.
+          platform->DrainTasks(isolate);
+
+          // If there are new tasks, continue.
+          more = uv_loop_alive(loop);
+          if (more) continue;
+
+          // node::EmitBeforeExit() is used to emit the 'beforeExit' event on
+          // the `process` object.
+          node::EmitBeforeExit(env.get());
+
+          // 'beforeExit' can also schedule new work that keeps the event loop
+          // running.
+          more = uv_loop_alive(loop);
+        } while (more == true);
+      }
+
+      // node::EmitExit() returns the current exit code.
+      exit_code = node::EmitExit(env.get());
+    }
 
     // node::Stop() can be used to explicitly stop the event loop and keep
     // further JavaScript from running. It can be called from any thread,
@@ -381,19 +991,7 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
     node::Stop(env.get());
   }
 
-  // Unregister the Isolate with the platform and add a listener that is called
-  // when the Platform is done cleaning up any state it had associated with
-  // the Isolate.
-  bool platform_finished = false;
-  platform->AddIsolateFinishedCallback(isolate, [](void* data) {
-    *static_cast<bool*>(data) = true;
-  }, &platform_finished);
-  platform->UnregisterIsolate(isolate);
-  isolate->Dispose();
-
-  // Wait until the platform has cleaned up all relevant resources.
-  while (!platform_finished)
-    uv_run(loop, UV_RUN_ONCE);
+  DisposeBoxednodeIsolate(platform, isolate, loop);
 #ifndef BOXEDNODE_USE_DEFAULT_UV_LOOP
   int err = uv_loop_close(loop);
   assert(err == 0);
@@ -401,23 +999,275 @@ static int RunNodeInstance(MultiIsolatePlatform* platform,
 
   return exit_code;
 }
+#endif // BOXEDNODE_LIBRARY
 #endif // BOXEDNODE_GENERATE_SNAPSHOT
 
+#ifdef BOXEDNODE_LIBRARY
+#include "boxednode.h"
+
+struct boxednode_instance {
+  size_t entry_point = 0;
+  uv_loop_t loop;
+  std::shared_ptr<ArrayBufferAllocator> allocator;
+#ifdef BOXEDNODE_CONSUME_SNAPSHOT
+  node::EmbedderSnapshotData::Pointer snapshot_blob;
+#endif
+  Isolate* isolate = nullptr;
+  std::unique_ptr<IsolateData, decltype(&node::FreeIsolateData)> isolate_data {
+    nullptr, node::FreeIsolateData };
+};
+
+namespace boxednode {
+namespace {
+std::unique_ptr<MultiIsolatePlatform> library_platform;
+std::string library_program_name;
+std::vector<std::string> library_exec_args;
+
+// Returns `process.boxednode.result` if the entry point set it to a string.
+std::optional<std::string> GetRunResult(Local<Context> context) {
+  Isolate* isolate = context->GetIsolate();
+  TryCatch try_catch(isolate);
+  Local<Value> value = context->Global();
+  for (const char* key : { "process", "boxednode", "result" }) {
+    if (!value->IsObject() ||
+        !value.As<Object>()->Get(
+            context, String::NewFromUtf8(isolate, key).ToLocalChecked()).ToLocal(&value)) {
+      return {};
+    }
+  }
+  if (!value->IsString()) return {};
+  String::Utf8Value utf8(isolate, value);
+  return std::string(*utf8, utf8.length());
+}
+} // anonymous namespace
+}
+
+extern "C" {
+int boxednode_initialize(int argc, const char* const* argv) {
+  std::vector<std::string> args(argv, argv + argc);
+  std::vector<std::string> errors;
+  if (args.empty()) args.emplace_back("boxednode");
+  // Unlike for executables, the remaining arguments are Node.js options.
+#ifdef BOXEDNODE_OPENSSL_DEFAULTS
+  if (!boxednode::CheckOpenSSLDefaults(
+          args[0].c_str(), std::vector<std::string>(args.begin() + 1, args.end())))
+    return 9;
+#endif
+#ifdef PASS_NO_NODE_SNAPSHOT_OPTION
+  args.insert(args.begin() + 1, "--no-node-snapshot");
+#endif
+#ifdef BOXEDNODE_USE_VM_MODULES
+  args.insert(args.begin() + 1, "--experimental-vm-modules");
+#endif
+#if OPENSSL_VERSION_MAJOR >= 3 && !defined(BOXEDNODE_OPENSSL_DEFAULTS)
+  args.insert(args.begin() + 1, "--openssl-shared-config");
+#endif
+
+  boxednode::MarkTime("Node.js Instance", "Start InitializeOncePerProcess");
+  auto result = node::InitializeOncePerProcess(args, {
+    node::ProcessInitializationFlags::kNoInitializeV8,
+    node::ProcessInitializationFlags::kNoInitializeNodeV8Platform,
+    node::ProcessInitializationFlags::kNoPrintHelpOrVersionOutput,
+    // Stdio and signal handling belong to the host application.
+    node::ProcessInitializationFlags::kNoStdioInitialization,
+    node::ProcessInitializationFlags::kNoDefaultSignalHandling,
+#ifdef BOXEDNODE_OPENSSL_DEFAULTS
+    node::ProcessInitializationFlags::kNoInitOpenSSL,
+#endif
+  });
+  boxednode::MarkTime("Node.js Instance", "Finished InitializeOncePerProcess");
+  for (const std::string& error : result->errors())
+    fprintf(stderr, "%s: %s\n", args[0].c_str(), error.c_str());
+  if (result->exit_code() != 0) {
+    return result->exit_code();
+  }
+  boxednode::library_program_name = args[0];
+  boxednode::library_exec_args = result->exec_args();
+
+  boxednode::library_platform = MultiIsolatePlatform::Create(4);
+  V8::InitializePlatform(boxednode::library_platform.get());
+  V8::Initialize();
+  boxednode::MarkTime("Node.js Instance", "Initialized V8");
+  return 0;
+}
+
+boxednode_instance* boxednode_instance_create(const char* entry_point) {
+  std::optional<size_t> index = boxednode::FindEntryPoint(entry_point);
+  if (!index) return nullptr;
+
+  auto instance = std::make_unique<boxednode_instance>();
+  instance->entry_point = *index;
+  if (uv_loop_init(&instance->loop) != 0) return nullptr;
+  instance->allocator = ArrayBufferAllocator::Create();
+  MultiIsolatePlatform* platform = boxednode::library_platform.get();
+
+#ifdef BOXEDNODE_CONSUME_SNAPSHOT
+#ifdef NODE_VERSION_SUPPORTS_STRING_VIEW_SNAPSHOT
+  std::optional<std::string_view> snapshot_sv = boxednode::GetBoxednodeSnapshotBlobSV(*index);
+  if (snapshot_sv) {
+    instance->snapshot_blob = EmbedderSnapshotData::FromBlob(snapshot_sv.value());
+  }
+#endif
+  if (!instance->snapshot_blob) {
+    instance->snapshot_blob =
+        EmbedderSnapshotData::FromBlob(boxednode::GetBoxednodeSnapshotBlobVector(*index));
+  }
+  instance->isolate = NewIsolate(
+      instance->allocator, &instance->loop, platform, instance->snapshot_blob.get());
+#else
+  instance->isolate = NewIsolate(instance->allocator, &instance->loop, platform);
+#endif
+  if (instance->isolate == nullptr) {
+    uv_loop_close(&instance->loop);
+    return nullptr;
+  }
+
+  {
+    Locker locker(instance->isolate);
+    Isolate::Scope isolate_scope(instance->isolate);
+    instance->isolate_data.reset(node::CreateIsolateData(
+        instance->isolate, &instance->loop, platform, instance->allocator.get()
+#ifdef BOXEDNODE_CONSUME_SNAPSHOT
+        , instance->snapshot_blob.get()
+#endif
+        ));
+  }
+  return instance.release();
+}
+
+int boxednode_instance_run(boxednode_instance* instance,
+                           int argc,
+                           const char* const* argv,
+                           char** result) {
+  if (result != nullptr) *result = nullptr;
+  boxednode::ResetTimingData();
+
+  std::vector<std::string> args { boxednode::library_program_name };
+#ifdef BOXEDNODE_CONSUME_SNAPSHOT
+  args.emplace_back("--boxednode-snapshot-argv-fixup");
+#endif
+  args.insert(args.end(), argv, argv + argc);
+
+  Isolate* isolate = instance->isolate;
+  int exit_code = 0;
+  std::optional<int> process_exit_code;
+  {
+    Locker locker(isolate);
+    Isolate::Scope isolate_scope(isolate);
+    HandleScope handle_scope(isolate);
+    Local<Context> context;
+#ifndef BOXEDNODE_CONSUME_SNAPSHOT
+    context = node::NewContext(isolate);
+    if (context.IsEmpty()) {
+      fprintf(stderr, "%s: Failed to initialize V8 Context\n", args[0].c_str());
+      return 1;
+    }
+    Context::Scope context_scope(context);
+#endif
+
+    // Every run gets a fresh Environment, so that no state is shared between
+    // runs, while the Isolate (and the deserialized snapshot) is re-used.
+    std::unique_ptr<Environment, decltype(&node::FreeEnvironment)> env(
+        node::CreateEnvironment(
+            instance->isolate_data.get(), context, args, boxednode::library_exec_args),
+        node::FreeEnvironment);
+#ifdef BOXEDNODE_CONSUME_SNAPSHOT
+    context = GetMainContext(env.get());
+    assert(!context.IsEmpty());
+    Context::Scope context_scope(context);
+#endif
+    boxednode::MarkTime("Node.js Instance", "Created Environment", isolate);
+
+    // process.exit() stops this Environment instead of the host process.
+    node::SetProcessExitHandler(env.get(), [&](Environment* env, int code) {
+      process_exit_code = code;
+      node::Stop(env);
+    });
+    AddBoxednodeLinkedBindings(env.get());
+    boxednode::MarkTime("Boxednode Binding", "Added bindings", isolate);
+
+    if (LoadBoxednodeEnvironment(context, instance->entry_point).IsEmpty()) {
+      exit_code = 1; // There has been a JS exception.
+    } else if (!process_exit_code) {
+      boxednode::MarkTime("Boxednode Binding", "Loaded Environment, entering loop", isolate);
+      exit_code = node::SpinEventLoop(env.get()).FromMaybe(1);
+    }
+    if (process_exit_code) {
+      exit_code = *process_exit_code;
+      isolate->CancelTerminateExecution();
+    }
+
+    if (result != nullptr) {
+      std::optional<std::string> value = boxednode::GetRunResult(context);
+      if (value) {
+        *result = static_cast<char*>(malloc(value->size() + 1));
+        memcpy(*result, value->c_str(), value->size() + 1);
+      }
+    }
+    // Not calling node::Stop() here: it terminates execution on the Isolate,
+    // which is shared with all later runs of this instance. Instead, free the
+    // Environment explicitly and clear any termination that is still pending.
+    env.reset();
+    isolate->CancelTerminateExecution();
+  }
+  return exit_code;
+}
+
+void boxednode_instance_dispose(boxednode_instance* instance) {
+  if (instance == nullptr) return;
+  {
+    Locker locker(instance->isolate);
+    Isolate::Scope isolate_scope(instance->isolate);
+    instance->isolate_data.reset();
+  }
+  DisposeBoxednodeIsolate(
+      boxednode::library_platform.get(), instance->isolate, &instance->loop);
+  int err = uv_loop_close(&instance->loop);
+  assert(err == 0);
+  delete instance;
+}
+
+void boxednode_free(char* result) {
+  free(result);
+}
+
+void boxednode_teardown(void) {
+  V8::Dispose();
+  V8::DisposePlatform();
+  node::TearDownOncePerProcess();
+  boxednode::library_platform.reset();
+}
+}
+#else // BOXEDNODE_LIBRARY
 static int BoxednodeMain(std::vector<std::string> args) {
   std::vector<std::string> exec_args;
   std::vector<std::string> errors;
 
+  boxednode::SelectEntryPoint(&args);
+
   if (args.size() > 0) {
       args.insert(args.begin() + 1, "--");
 #ifdef PASS_NO_NODE_SNAPSHOT_OPTION
     args.insert(args.begin() + 1, "--no-node-snapshot");
+#endif
+#ifdef BOXEDNODE_USE_VM_MODULES
+    // Required for running ES module entry points through vm.SourceTextModule.
+    args.insert(args.begin() + 1, "--experimental-vm-modules");
 #endif
   }
 
+#ifdef BOXEDNODE_OPENSSL_DEFAULTS
+  // Node.js options can only be passed through NODE_OPTIONS here.
+  if (!boxednode::CheckOpenSSLDefaults(args.empty() ? "boxednode" : args[0].c_str(), {}))
+    return 9;
+#endif
+
   // Parse Node.js CLI options, and print any errors that have occurred while
   // trying to parse them.
 #ifdef USE_OWN_LEGACY_PROCESS_INITIALIZATION
+  boxednode::MarkTime("Node.js Instance", "Start InitializeOncePerProcess");
   boxednode::InitializeOncePerProcess();
+  boxednode::MarkTime("Node.js Instance", "Finished InitializeOncePerProcess");
   int exit_code = node::InitializeNodeWithArgs(&args, &exec_args, &errors);
   for (const std::string& error : errors)
     fprintf(stderr, "%s: %s\n", args[0].c_str(), error.c_str());
@@ -425,15 +1275,26 @@ static int BoxednodeMain(std::vector<std::string> args) {
     return exit_code;
   }
 #else
-#if OPENSSL_VERSION_MAJOR >= 3
+#if OPENSSL_VERSION_MAJOR >= 3 && !defined(BOXEDNODE_OPENSSL_DEFAULTS)
   if (args.size() > 1)
     args.insert(args.begin() + 1, "--openssl-shared-config");
+#endif
+#ifdef BOXEDNODE_LARGE_PAGES
+  // Remaps the hot part of .text onto transparent huge pages. Without THP
+  // support, this silently keeps using regular pages.
+  if (args.size() > 1)
+    args.insert(args.begin() + 1, "--use-largepages=silent");
 #endif
   boxednode::MarkTime("Node.js Instance", "Start InitializeOncePerProcess");
   auto result = node::InitializeOncePerProcess(args, {
     node::ProcessInitializationFlags::kNoInitializeV8,
     node::ProcessInitializationFlags::kNoInitializeNodeV8Platform,
-    node::ProcessInitializationFlags::kNoPrintHelpOrVersionOutput
+    node::ProcessInitializationFlags::kNoPrintHelpOrVersionOutput,
+#ifdef BOXEDNODE_OPENSSL_DEFAULTS
+    // OpenSSL initializes itself, using its default configuration, the
+    // first time that it is used (e.g. by the crypto or tls modules).
+    node::ProcessInitializationFlags::kNoInitOpenSSL,
+#endif
   });
   boxednode::MarkTime("Node.js Instance", "Finished InitializeOncePerProcess");
   for (const std::string& error : result->errors())
@@ -445,6 +1306,10 @@ static int BoxednodeMain(std::vector<std::string> args) {
   exec_args = result->exec_args();
 #endif
 
+#ifdef BOXEDNODE_PREFETCH_BLOBS
+  boxednode::StartBlobPrefetch();
+#endif
+
 #ifdef BOXEDNODE_CONSUME_SNAPSHOT
   if (args.size() > 0) {
     args.insert(args.begin() + 1, "--boxednode-snapshot-argv-fixup");
@@ -513,6 +1378,7 @@ int main(int argc, char** argv) {
   return BoxednodeMain(std::move(args));
 }
 #endif
+#endif // BOXEDNODE_LIBRARY
 
 // The code below is mostly lifted directly from node.cc
 #ifdef USE_OWN_LEGACY_PROCESS_INITIALIZATION
@@ -552,7 +1418,7 @@ static PVOID old_vectored_exception_handler;
 
 namespace boxednode {
 
-#if HAVE_OPENSSL
+#if HAVE_OPENSSL && !defined(BOXEDNODE_OPENSSL_DEFAULTS)
 static void CheckEntropy() {
   for (;;) {
     int status = RAND_status();
@@ -847,6 +1713,7 @@ void ResetStdio() {
 #endif  // __POSIX__
 }
 
+#ifndef BOXEDNODE_OPENSSL_DEFAULTS
 static void InitializeOpenSSL() {
 #if HAVE_OPENSSL && !defined(OPENSSL_IS_BORINGSSL)
   // In the case of FIPS builds we should make sure
@@ -877,11 +1744,14 @@ static void InitializeOpenSSL() {
   V8::SetEntropySource(boxednode::EntropySource);
 #endif
 }
+#endif  // BOXEDNODE_OPENSSL_DEFAULTS
 
 void InitializeOncePerProcess() {
   atexit(ResetStdio);
   PlatformInit();
+#ifndef BOXEDNODE_OPENSSL_DEFAULTS
   InitializeOpenSSL();
+#endif
 }
 
 void TearDownOncePerProcess() {
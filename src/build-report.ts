@@ -0,0 +1,222 @@
+import { promises as fs } from 'fs';
+import path from 'path';
+import os from 'os';
+import zlib from 'zlib';
+import { promisify } from 'util';
+import { execFile } from 'child_process';
+
+// Raw and gzip-compressed sizes in bytes. `embedded` is the number of bytes
+// that the component occupies in the binary, where that differs from `raw`
+// (e.g. compressed blobs or UTF-16 strings). The ICU size is that of the data
+// file that is embedded into the binary.
+export type ComponentSize = {
+  raw: number,
+  gzip: number,
+  embedded: number
+};
+
+export type EntryPointReport = {
+  size: {
+    mainSource: ComponentSize,
+    moduleGraph: ComponentSize,
+    codeCache: ComponentSize,
+    snapshot: ComponentSize
+  },
+  // Median durations in milliseconds of the startup phases that depend on
+  // the embedded components, or null if a phase did not occur.
+  startup: Record<keyof typeof startupSpans, number | null> & {
+    // Median times in milliseconds since process start for all timing marks.
+    marks: { category: string, label: string, time: number }[]
+  }
+};
+
+export type BuildReport = {
+  nodeVersion: string,
+  size: {
+    total: ComponentSize,
+    // Everything that is not attributed to ICU data or the entry points,
+    // including the code that is linked in from addons.
+    nodeCore: number,
+    icuData: ComponentSize | null,
+    // Sizes of the static libraries that addons are built as. The linker
+    // only includes the parts of them that are used, so these are upper
+    // bounds for the addons' share of `nodeCore`.
+    addonArchives: Record<string, ComponentSize | null>
+  },
+  entryPoints: Record<string, EntryPointReport>
+};
+
+export type EntryPointReportData = {
+  name: string,
+  jsMainSource: string,
+  moduleGraphSource: string,
+  codeCacheBlob: Uint8Array,
+  snapshotBlob: Uint8Array
+};
+
+// Pairs of timing marks that enclose the startup work for each component.
+// Blobs may be decoded on a background thread, in parallel to other marks.
+const startupSpans = {
+  nodeCore: ['Process initialization', 'Initialized V8'],
+  snapshotDecode: ['Started decoding blobs', 'Decoded snapshot'],
+  snapshotDeserialize: ['Read snapshot', 'Created Environment'],
+  codeCacheDecode: ['Started decoding blobs', 'Decoded code cache'],
+  addons: ['Created Environment', 'Added bindings'],
+  mainSource: ['Calling entrypoint', 'Called entrypoint']
+};
+
+const kStartupRuns = 5;
+
+function median (values: number[]): number {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted[Math.floor(sorted.length / 2)];
+}
+
+async function componentSize (data: Uint8Array | string, embedded?: number): Promise<ComponentSize> {
+  const buffer = typeof data === 'string' ? Buffer.from(data) : data;
+  return {
+    raw: buffer.length,
+    gzip: buffer.length > 0 ? (await promisify(zlib.gzip)(buffer, { level: 9 })).length : 0,
+    embedded: embedded ?? buffer.length
+  };
+}
+
+// Matches createCppJsStringDefinition(), which embeds Latin-1 strings with
+// one byte per character and other strings as UTF-16.
+function embeddedStringSize (source: string): number {
+  return /^[\0-\xff]*$/.test(source) ? source.length : source.length * 2;
+}
+
+async function embeddedBlobSize (blob: Uint8Array, compressBlobs: boolean): Promise<number> {
+  if (!compressBlobs || blob.length === 0) return blob.length;
+  return (await promisify(zlib.brotliCompress)(blob, {
+    params: {
+      [zlib.constants.BROTLI_PARAM_QUALITY]: zlib.constants.BROTLI_MAX_QUALITY,
+      [zlib.constants.BROTLI_PARAM_SIZE_HINT]: blob.length
+    }
+  })).length;
+}
+
+async function findFiles (dir: string, predicate: (name: string) => boolean): Promise<string[]> {
+  const result: string[] = [];
+  let entries;
+  try {
+    entries = await fs.readdir(dir, { withFileTypes: true });
+  } catch {
+    return result;
+  }
+  for (const entry of entries) {
+    const entryPath = path.join(dir, entry.name);
+    if (entry.isDirectory()) {
+      result.push(...await findFiles(entryPath, predicate));
+    } else if (predicate(entry.name)) {
+      result.push(entryPath);
+    }
+  }
+  return result;
+}
+
+async function fileSize (file: string | undefined): Promise<ComponentSize | null> {
+  return file ? await componentSize(await fs.readFile(file)) : null;
+}
+
+// Runs the binary with BOXEDNODE_STARTUP_REPORT_FILE and the build's nonce
+// set, which makes it record its timing data and exit before running the
+// application code.
+async function measureStartup (binaryPath: string, nonce: string, entryPoint: string): Promise<EntryPointReport['startup']> {
+  const reportDir = await fs.mkdtemp(path.join(os.tmpdir(), 'boxednode-startup-report-'));
+  const runs: [string, string, number][][] = [];
+  try {
+    for (let i = 0; i < kStartupRuns; i++) {
+      const reportFile = path.join(reportDir, `run-${i}.json`);
+      await promisify(execFile)(binaryPath, entryPoint ? [entryPoint] : [], {
+        env: {
+          ...process.env,
+          BOXEDNODE_STARTUP_REPORT_FILE: reportFile,
+          BOXEDNODE_STARTUP_REPORT_NONCE: nonce
+        }
+      });
+      runs.push(JSON.parse(await fs.readFile(reportFile, 'utf8')));
+    }
+  } finally {
+    await fs.rm(reportDir, { recursive: true, force: true });
+  }
+
+  const toMs = (ns: number) => ns / 1e6;
+  const timeOf = (run: [string, string, number][], label: string) =>
+    run.find(([, l]) => l === label)?.[2];
+  const startup = { marks: [] } as EntryPointReport['startup'];
+  for (const [component, [start, end]] of Object.entries(startupSpans)) {
+    const durations = runs
+      .map(run => [timeOf(run, start), timeOf(run, end)])
+      .filter(([s, e]) => s !== undefined && e !== undefined)
+      .map(([s, e]) => toMs(e - s));
+    startup[component] = durations.length === runs.length ? median(durations) : null;
+  }
+  // Marks are matched by label, since e.g. cache hits and misses can make
+  // them differ between runs.
+  startup.marks = runs[0].map(([category, label]) => ({
+    category,
+    label,
+    time: median(runs
+      .map(run => timeOf(run, label))
+      .filter(time => time !== undefined)
+      .map(toMs))
+  }));
+  return startup;
+}
+
+export async function createBuildReport ({
+  binaryPath,
+  startupReportNonce,
+  nodeSourcePath,
+  nodeVersion,
+  compressBlobs,
+  addonTargets,
+  entryPoints
+}: {
+  binaryPath: string,
+  startupReportNonce: string,
+  nodeSourcePath: string,
+  nodeVersion: string,
+  compressBlobs: boolean,
+  addonTargets: string[],
+  entryPoints: EntryPointReportData[]
+}): Promise<BuildReport> {
+  const buildOutput = path.join(nodeSourcePath, process.platform === 'win32' ? 'Release' : path.join('out', 'Release'));
+  const icuData = await findFiles(buildOutput, name => /^icudt\d+[lb]\.dat$/.test(name));
+
+  const addonArchives: BuildReport['size']['addonArchives'] = {};
+  for (const target of addonTargets) {
+    const [lib] = await findFiles(buildOutput, name => name === `lib${target}.a` || name === `${target}.lib`);
+    addonArchives[target] = await fileSize(lib);
+  }
+
+  const report: BuildReport = {
+    nodeVersion,
+    size: {
+      total: await componentSize(await fs.readFile(binaryPath)),
+      nodeCore: 0,
+      icuData: await fileSize(icuData[0]),
+      addonArchives
+    },
+    entryPoints: {}
+  };
+
+  let attributed = report.size.icuData?.embedded ?? 0;
+  for (const { name, jsMainSource, moduleGraphSource, codeCacheBlob, snapshotBlob } of entryPoints) {
+    const size = {
+      mainSource: await componentSize(jsMainSource, embeddedStringSize(jsMainSource)),
+      moduleGraph: await componentSize(moduleGraphSource, embeddedStringSize(moduleGraphSource)),
+      codeCache: await componentSize(codeCacheBlob, await embeddedBlobSize(codeCacheBlob, compressBlobs)),
+      snapshot: await componentSize(snapshotBlob, await embeddedBlobSize(snapshotBlob, compressBlobs))
+    };
+    attributed += Object.values(size).reduce((sum, { embedded }) => sum + embedded, 0);
+    report.entryPoints[name || '(default)'] = {
+      size,
+      startup: await measureStartup(binaryPath, startupReportNonce, name)
+    };
+  }
+  report.size.nodeCore = Math.max(report.size.total.raw - attributed, 0);
+  return report;
+}
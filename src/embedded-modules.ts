@@ -0,0 +1,184 @@
+import { promises as fs } from 'fs';
+import path from 'path';
+import Module from 'module';
+import pkgUp from 'pkg-up';
+import { fileURLToPath } from 'url';
+
+// The CommonJS modules that are embedded into the binary alongside the main
+// script. All paths are relative to the common ancestor directory of the
+// embedded files, using forward slashes.
+export type EmbeddedModuleGraph = {
+  entry: string,
+  files: Record<string, string>,
+  // For each embedded file, the results of resolving its static require()
+  // calls at build time, so that the runtime loader only has to resolve
+  // dynamic require() calls itself.
+  resolutions: Record<string, Record<string, string>>,
+  // Embedded files (and possibly the entry point) that are ES modules.
+  esModules: string[]
+};
+
+const embeddableExtensions = ['.js', '.cjs', '.mjs', '.json'];
+
+// Determine whether a file is an ES module, following the same rules as
+// Node.js: .mjs files are, and .js files are if the nearest package.json
+// file has `"type": "module"`.
+export async function isESModuleFile (file: string): Promise<boolean> {
+  switch (path.extname(file)) {
+    case '.mjs':
+      return true;
+    case '.js': {
+      const packageJson = await pkgUp({ cwd: path.dirname(file) });
+      if (!packageJson) return false;
+      try {
+        return JSON.parse(await fs.readFile(packageJson, 'utf8')).type === 'module';
+      } catch {
+        return false;
+      }
+    }
+    default:
+      return false;
+  }
+}
+
+// Requests made through require() in CommonJS modules, and through static
+// imports, re-exports and dynamic import() calls in ES modules.
+function findStaticRequests (source: string, isESModule: boolean): string[] {
+  const regexps = isESModule ? [
+    /\bimport\s*(?:[\w$*{}\s,]+?\s*from\s*)?(['"])([^'"\n]+)\1/g,
+    /\bexport\s*(?:\*(?:\s*as\s+[\w$]+)?|\{[^}]*\})\s*from\s*(['"])([^'"\n]+)\1/g,
+    /\bimport\s*\(\s*(['"])([^'"\n]+)\1\s*\)/g
+  ] : [
+    /\brequire\s*\(\s*(['"])([^'"\n]+)\1\s*\)/g
+  ];
+  const requests: string[] = [];
+  for (const regexp of regexps) {
+    let match: RegExpExecArray | null;
+    while ((match = regexp.exec(source)) !== null) {
+      requests.push(match[2]);
+    }
+  }
+  return requests;
+}
+
+// Imports of relative paths need to include file extensions, so they can be
+// resolved directly. Package imports are resolved like require() calls,
+// i.e. without taking the "import" condition of package exports into account.
+function resolveRequest (request: string, fromFile: string, isESModule: boolean): string {
+  if (request.startsWith('file:')) {
+    return fileURLToPath(request);
+  }
+  if (isESModule && /^\.\.?\//.test(request)) {
+    return path.resolve(path.dirname(fromFile), request);
+  }
+  return require.resolve(request, { paths: [path.dirname(fromFile)] });
+}
+
+function isBuiltinModule (request: string): boolean {
+  return request.startsWith('node:') || Module.builtinModules.includes(request);
+}
+
+function isEmbeddable (file: string): boolean {
+  return embeddableExtensions.includes(path.extname(file));
+}
+
+async function listEmbeddableFiles (fileOrDir: string): Promise<string[]> {
+  if (!(await fs.stat(fileOrDir)).isDirectory()) {
+    return [fileOrDir];
+  }
+  const result: string[] = [];
+  for (const entry of await fs.readdir(fileOrDir, { withFileTypes: true })) {
+    const entryPath = path.join(fileOrDir, entry.name);
+    if (entry.isDirectory()) {
+      result.push(...await listEmbeddableFiles(entryPath));
+    } else if (isEmbeddable(entryPath)) {
+      result.push(entryPath);
+    }
+  }
+  return result;
+}
+
+function commonAncestorDirectory (files: string[]): string {
+  let ancestor = path.dirname(files[0]);
+  for (const file of files) {
+    while (path.relative(ancestor, file).startsWith('..')) {
+      ancestor = path.dirname(ancestor);
+    }
+  }
+  return ancestor;
+}
+
+// Collect the CommonJS module graph of `entryFile` by following require()
+// calls with string literal arguments. Files that are only loaded through
+// dynamic require() calls can be added through `extraFiles`, which may also
+// list directories. Built-in modules, requests matching `ignoreRequests`
+// (e.g. linked addons) and requests that cannot be resolved at build time
+// are left to the regular `require()` at runtime.
+export async function collectModuleGraph (
+  entryFile: string,
+  extraFiles: string[],
+  ignoreRequests: RegExp[]): Promise<EmbeddedModuleGraph> {
+  entryFile = path.resolve(entryFile);
+  const sources = new Map<string, string>();
+  const resolutions = new Map<string, Record<string, string>>();
+  const esModules = new Set<string>();
+  const queue: string[] = [entryFile];
+  for (const fileOrDir of extraFiles) {
+    queue.push(...await listEmbeddableFiles(path.resolve(fileOrDir)));
+  }
+
+  while (queue.length > 0) {
+    const file = queue.shift();
+    if (sources.has(file)) continue;
+    // Strip shebang lines, which are not valid inside a function body.
+    const source = (await fs.readFile(file, 'utf8')).replace(/^#!.*/, '');
+    sources.set(file, source);
+    if (path.extname(file) === '.json') continue;
+
+    const isESModule = await isESModuleFile(file);
+    if (isESModule) {
+      esModules.add(file);
+    }
+
+    const fileResolutions: Record<string, string> = {};
+    for (const request of findStaticRequests(source, isESModule)) {
+      if (isBuiltinModule(request) || ignoreRequests.some(re => re.test(request))) {
+        continue;
+      }
+      let resolved: string;
+      try {
+        resolved = resolveRequest(request, file, isESModule);
+        await fs.access(resolved);
+      } catch {
+        continue; // e.g. optional dependencies
+      }
+      if (!isEmbeddable(resolved)) continue;
+      fileResolutions[request] = resolved;
+      queue.push(resolved);
+    }
+    resolutions.set(file, fileResolutions);
+  }
+
+  const root = commonAncestorDirectory([...sources.keys()]);
+  const relative = (file: string) => path.relative(root, file).split(path.sep).join('/');
+  const graph: EmbeddedModuleGraph = {
+    entry: relative(entryFile),
+    files: {},
+    resolutions: {},
+    esModules: [...esModules].map(relative)
+  };
+  for (const [file, source] of sources) {
+    // The entry point's source is embedded separately as the main script.
+    if (file !== entryFile) {
+      graph.files[relative(file)] = source;
+    }
+  }
+  for (const [file, fileResolutions] of resolutions) {
+    const relativeResolutions: Record<string, string> = {};
+    for (const [request, resolved] of Object.entries(fileResolutions)) {
+      relativeResolutions[request] = relative(resolved);
+    }
+    graph.resolutions[relative(file)] = relativeResolutions;
+  }
+  return graph;
+}
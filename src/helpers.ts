@@ -1,6 +1,7 @@
 import { promises as fs } from 'fs';
 import { Logger } from './logger';
 import crypto from 'crypto';
+import path from 'path';
 import childProcess from 'child_process';
 import { promisify } from 'util';
 import tar from 'tar';
@@ -16,6 +17,7 @@ export type BuildCommandOptions = {
   cwd: string,
   logger: Logger,
   env: ProcessEnv,
+  stdio?: childProcess.StdioOptions
 };
 
 // Run a build command, e.g. `./configure`, `make`, `vcbuild`, etc.
@@ -49,6 +51,92 @@ export async function spawnBuildCommand (
   options.logger.stepCompleted();
 }
 
+// A GNU make jobserver that can be shared between multiple concurrently
+// running `make` processes, so that their combined parallelism stays close to
+// `jobs` instead of each of them using all CPUs. The token pool lives in a
+// FIFO that is passed to each `make` process as file descriptor 3.
+// Each `make` process has one implicit job slot in addition to the shared
+// tokens, so the pool contains `jobs - 1` tokens.
+export class MakeJobserver {
+  private constructor (private readonly fifo: fs.FileHandle, readonly jobs: number) {}
+
+  static async create (jobs: number, dir: string): Promise<MakeJobserver | null> {
+    if (process.platform === 'win32') return null;
+    await fs.mkdir(dir, { recursive: true });
+    const fifoPath = path.join(dir, `jobserver-${process.pid}-${crypto.randomBytes(4).toString('hex')}`);
+    await promisify(childProcess.execFile)('mkfifo', ['-m', '600', fifoPath]);
+    // Opening the FIFO for reading and writing does not block, and keeps it
+    // usable after it has been removed from the file system.
+    const fifo = await fs.open(fifoPath, 'r+');
+    await fs.unlink(fifoPath);
+    if (jobs > 1) {
+      await fifo.write(Buffer.alloc(jobs - 1, '+'));
+    }
+    return new MakeJobserver(fifo, jobs);
+  }
+
+  // Environment variables and stdio configuration for a `make` invocation
+  // that participates in this jobserver.
+  makeOptions (env: ProcessEnv): { env: ProcessEnv, stdio: childProcess.StdioOptions } {
+    return {
+      env: {
+        ...env,
+        MAKEFLAGS: `${env.MAKEFLAGS ?? ''} -j${this.jobs} --jobserver-auth=3,3`.trim()
+      },
+      stdio: ['inherit', 'inherit', 'inherit', this.fifo.fd]
+    };
+  }
+
+  async close (): Promise<void> {
+    await this.fifo.close();
+  }
+}
+
+// Like Promise.all(items.map(fn)), but with at most `limit` calls to `fn`
+// running at any given time.
+export async function mapWithConcurrency<T, R> (
+  items: readonly T[],
+  limit: number,
+  fn: (item: T, index: number) => Promise<R>): Promise<R[]> {
+  const results: R[] = new Array(items.length);
+  let next = 0;
+  async function worker (): Promise<void> {
+    while (next < items.length) {
+      const index = next++;
+      results[index] = await fn(items[index], index);
+    }
+  }
+  await Promise.all(
+    Array.from({ length: Math.max(Math.min(limit, items.length), 1) }, worker));
+  return results;
+}
+
+// Write a file only if its contents would change. This preserves the mtime of
+// unchanged files, so that repeated builds in the same Node.js source tree are
+// incremental instead of recompiling everything that depends on them.
+export async function writeFileIfChanged (file: string, contents: string | Uint8Array): Promise<boolean> {
+  try {
+    if ((await fs.readFile(file)).equals(Buffer.from(contents))) {
+      return false;
+    }
+  } catch { /* file does not exist yet */ }
+  await fs.writeFile(file, contents);
+  return true;
+}
+
+// Returns the path of a copy of a Node.js source file as it was before
+// boxednode first modified it, so that patches can always be applied to the
+// original contents and are not applied repeatedly when re-using a source tree.
+export async function getOriginalSourceFile (file: string): Promise<string> {
+  const originalFile = `${file}.boxednode-orig`;
+  try {
+    await fs.access(originalFile);
+  } catch {
+    await fs.copyFile(file, originalFile);
+  }
+  return originalFile;
+}
+
 export async function copyRecursive (sourceDir: string, targetDir: string): Promise<void> {
   await fs.mkdir(targetDir, { recursive: true });
   await pipeline(
@@ -69,6 +157,25 @@ export function objhash (value: unknown): string {
     .slice(0, 32);
 }
 
+// A cheap fingerprint of a directory's contents, based on the names, sizes
+// and modification times of all files in it.
+export async function directoryFingerprint (dir: string): Promise<string> {
+  const entries: [string, number, number][] = [];
+  async function walk (relative: string): Promise<void> {
+    for (const entry of await fs.readdir(path.join(dir, relative), { withFileTypes: true })) {
+      const entryPath = path.join(relative, entry.name);
+      if (entry.isDirectory()) {
+        await walk(entryPath);
+      } else {
+        const { size, mtimeMs } = await fs.lstat(path.join(dir, entryPath));
+        entries.push([entryPath, size, mtimeMs]);
+      }
+    }
+  }
+  await walk('.');
+  return objhash(entries.sort(([a], [b]) => a < b ? -1 : a > b ? 1 : 0));
+}
+
 export function npm (): string[] {
   if (process.env.npm_execpath) {
     return [process.execPath, process.env.npm_execpath];
@@ -133,6 +240,25 @@ export async function createUncompressedBlobDefinition (fnName: string, source:
   ${blobTypedArrayAccessors(fnName, source.length)}`;
 }
 
+// Cheap checksum of blob contents, which the generated binary uses to verify
+// decompressed blob cache files. Must match BlobChecksum() in
+// resources/main-template.cc.
+export function blobChecksum (data: Uint8Array): number[] {
+  const prime = 0x9e3779b1;
+  const lanes = [0x811c9dc5, 0x01000193, 0xcc9e2d51, 0x1b873593];
+  const view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+  const blocksEnd = data.length - data.length % 16;
+  for (let i = 0; i < blocksEnd; i += 16) {
+    for (let lane = 0; lane < 4; lane++) {
+      lanes[lane] = Math.imul(lanes[lane] ^ view.getUint32(i + lane * 4, true), prime);
+    }
+  }
+  for (let i = blocksEnd; i < data.length; i++) {
+    lanes[0] = Math.imul(lanes[0] ^ data[i], prime);
+  }
+  return lanes.map(lane => lane >>> 0);
+}
+
 export async function createCompressedBlobDefinition (fnName: string, source: Uint8Array): Promise<string> {
   const compressed = await promisify(zlib.brotliCompress)(source, {
     params: {
@@ -140,6 +266,12 @@ export async function createCompressedBlobDefinition (fnName: string, source: Ui
       [zlib.constants.BROTLI_PARAM_SIZE_HINT]: source.length
     }
   });
+  // Used for naming entries in the decompressed blob cache, so that
+  // different builds never share cache files.
+  const cacheKey = crypto.createHash('sha256')
+    .update(compressed)
+    .digest('hex')
+    .slice(0, 32);
   return `
   static const uint8_t ${fnName}_source_[] = {
     ${Uint8Array.prototype.toString.call(compressed) || '0'}
@@ -159,8 +291,30 @@ export async function createCompressedBlobDefinition (fnName: string, source: Ui
     assert(decoded_size == ${source.length});
   }
 
+  // Returns nullptr if the decompressed blob cache is unavailable.
+  static char* ${fnName}_Cached() {
+#ifdef BOXEDNODE_CACHE_DECOMPRESSED_BLOBS
+    ${source.length === 0 ? 'return nullptr;' : `
+    static const DecompressedBlobCacheEntry entry = {
+      "${fnName}-${cacheKey}.bin",
+      ${source.length},
+      { ${blobChecksum(source).map(lane => `0x${lane.toString(16)}`).join(', ')} },
+      ${fnName}_Read,
+      "Cache hit: ${fnName}",
+      "Cache miss: ${fnName}"
+    };
+    static char* const data = GetCachedDecompressedBlob(entry);
+    return data;`}
+#else
+    return nullptr;
+#endif
+  }
+
   std::vector<char> ${fnName}Vector() {
     ${source.length === 0 ? 'return {};' : `
+    if (const char* cached = ${fnName}_Cached()) {
+      return std::vector<char>(cached, cached + ${source.length});
+    }
     std::vector<char> dst(${source.length});
     ${fnName}_Read(&dst[0]);
     return dst;`}
@@ -168,17 +322,29 @@ export async function createCompressedBlobDefinition (fnName: string, source: Ui
 
 #ifdef NODE_VERSION_SUPPORTS_STRING_VIEW_SNAPSHOT
   std::optional<std::string_view> ${fnName}SV() {
+    if (const char* cached = ${fnName}_Cached()) {
+      return { { cached, ${source.length} } };
+    }
     return {};
   }
 #endif
 
-  ${blobTypedArrayAccessors(fnName, source.length)}
+  ${blobTypedArrayAccessors(fnName, source.length, `${fnName}_Cached()`)}
   `;
 }
 
-function blobTypedArrayAccessors (fnName: string, sourceLength: number): string {
+function blobTypedArrayAccessors (fnName: string, sourceLength: number, mappedData?: string): string {
   return `
   std::shared_ptr<v8::BackingStore> ${fnName}BackingStore() {
+    ${mappedData ? `
+    // Mapped data is never released, so no deleter is needed.
+    if (char* mapped = ${mappedData}) {
+      return v8::SharedArrayBuffer::NewBackingStore(
+        mapped,
+        ${sourceLength},
+        [](void*, size_t, void*) {},
+        nullptr);
+    }` : ''}
     std::vector<char>* str = new std::vector<char>(${fnName}Vector());
     return v8::SharedArrayBuffer::NewBackingStore(
       &str->front(),
@@ -199,3 +365,24 @@ function blobTypedArrayAccessors (fnName: string, sourceLength: number): string
   }
   `;
 }
+
+// Defines `${prefix}${suffix}` so that it forwards to `${prefix}_${i}${suffix}`
+// for the entry point with the index passed as its first argument.
+export function createEntryPointDispatchDefinition (
+  returnType: string,
+  prefix: string,
+  suffix: string,
+  params: string,
+  args: string,
+  entryPointCount: number): string {
+  const cases = Array.from({ length: entryPointCount }, (_, i) =>
+    `case ${i}: return ${prefix}_${i}${suffix}(${args});`);
+  return `
+  ${returnType} ${prefix}${suffix}(${['size_t entry_point', params].filter(Boolean).join(', ')}) {
+    switch (entry_point) {
+      ${cases.join('\n      ')}
+    }
+    abort();
+  }
+  `;
+}
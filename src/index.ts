@@ -1,5 +1,5 @@
 'use strict';
-import { Logger, LoggerImpl } from './logger';
+import { Logger, LoggerImpl, TargetLoggerImpl, ChildLogger } from './logger';
 import fetch from 'node-fetch';
 import tar from 'tar';
 import path from 'path';
@@ -9,17 +9,162 @@ import rimraf from 'rimraf';
 import crypto from 'crypto';
 import { promisify } from 'util';
 import { promises as fs, createReadStream, createWriteStream } from 'fs';
-import { AddonConfig, loadGYPConfig, storeGYPConfig, modifyAddonGyp } from './native-addons';
+import { AddonConfig, AddonResult, loadGYPConfig, storeGYPConfig, modifyAddonGyp } from './native-addons';
 import { ExecutableMetadata, generateRCFile } from './executable-metadata';
-import { spawnBuildCommand, ProcessEnv, pipeline, createCppJsStringDefinition, createCompressedBlobDefinition, createUncompressedBlobDefinition } from './helpers';
+import { collectModuleGraph, isESModuleFile } from './embedded-modules';
+import { createBuildReport } from './build-report';
+import { spawnBuildCommand, ProcessEnv, pipeline, createCppJsStringDefinition, createCompressedBlobDefinition, createUncompressedBlobDefinition, createEntryPointDispatchDefinition, MakeJobserver, mapWithConcurrency, objhash, writeFileIfChanged, getOriginalSourceFile } from './helpers';
 import { Readable } from 'stream';
 import nv from '@pkgjs/nv';
-import { fileURLToPath, URL } from 'url';
+import { fileURLToPath, pathToFileURL, URL } from 'url';
 import { execFile } from 'child_process';
 import { once } from 'events';
 
-// Download and unpack a tarball containing the code for a specific Node.js version.
-async function getNodeSourceForVersion (range: string, dir: string, logger: Logger, retries = 2): Promise<string> {
+type NodeRelease = {
+  version: string,
+  releaseBaseUrl: string,
+  tarballName: string
+};
+
+// Figure out which Node.js release a version range refers to.
+async function resolveNodeRelease (range: string): Promise<NodeRelease> {
+  let releaseBaseUrl: string;
+  let version: string;
+  if (range.match(/-nightly\d+/)) {
+    version = range.startsWith('v') ? range : `v${range}`;
+    releaseBaseUrl = `https://nodejs.org/download/nightly/${version}`;
+  } else {
+    const ver = (await nv(range)).pop();
+    if (!ver) {
+      throw new Error(`No node version found for ${range}`);
+    }
+    version = `v${ver.version}`;
+
+    releaseBaseUrl = `https://nodejs.org/download/release/${version}`;
+  }
+
+  return { version, releaseBaseUrl, tarballName: `node-${version}.tar.gz` };
+}
+
+// Check whether a previously downloaded tarball exists and matches the
+// published checksum for its release.
+async function verifyCachedTarball (
+  { releaseBaseUrl, tarballName }: NodeRelease,
+  cachedTarballPath: string,
+  logger: Logger): Promise<boolean> {
+  try {
+    if ((await fs.stat(cachedTarballPath)).size === 0) return false;
+  } catch {
+    return false;
+  }
+  const shaSumsUrl = `${releaseBaseUrl}/SHASUMS256.txt`;
+  logger.stepStarting(`Verifying existing tarball via ${shaSumsUrl}`);
+  const [expectedSha, realSha] = await Promise.all([
+    (async () => {
+      try {
+        const shaSums = await fetch(shaSumsUrl);
+        if (!shaSums.ok) return;
+        const text = await shaSums.text();
+        for (const line of text.split('\n')) {
+          if (line.trim().endsWith(tarballName)) {
+            return line.match(/^([0-9a-fA-F]+)\b/)[0];
+          }
+        }
+      } catch {}
+    })(),
+    (async () => {
+      const hash = crypto.createHash('sha256');
+      await pipeline(createReadStream(cachedTarballPath), hash);
+      return hash.digest('hex');
+    })()
+  ]);
+  if (expectedSha !== realSha) {
+    logger.stepFailed(new Error(
+      `SHA256 mismatch: got ${realSha}, expected ${expectedSha}`));
+    return false;
+  }
+  return true;
+}
+
+// Download the tarball for a Node.js release into `dir` without unpacking it,
+// re-using a previously downloaded and verified copy if there is one.
+// Returns the path to the tarball.
+async function fetchNodeTarball (release: NodeRelease, dir: string, logger: Logger, retries = 2): Promise<string> {
+  const cachedTarballPath = path.join(dir, release.tarballName);
+  if (await verifyCachedTarball(release, cachedTarballPath, logger)) {
+    logger.stepCompleted();
+    return cachedTarballPath;
+  }
+
+  const url = `${release.releaseBaseUrl}/${release.tarballName}`;
+  logger.stepStarting(`Downloading from ${url}`);
+  // The tarball is downloaded to a temporary file and renamed into place
+  // once complete, since `dir` may be shared with concurrent builds and
+  // later ones must never pick up a partial download.
+  const tmpTarballPath = `${cachedTarballPath}.${process.pid}.${crypto.randomBytes(4).toString('hex')}.tmp`;
+  try {
+    const tarball = await fetch(url);
+    if (!tarball.ok) {
+      throw new Error(`Could not download Node.js source tarball: ${tarball.statusText}`);
+    }
+    await fs.mkdir(dir, { recursive: true });
+    await pipeline(tarball.body, createWriteStream(tmpTarballPath));
+    await fs.rename(tmpTarballPath, cachedTarballPath);
+  } catch (err) {
+    await fs.rm(tmpTarballPath, { force: true });
+    if (retries > 0) {
+      logger.stepFailed(err);
+      logger.stepStarting('Re-trying');
+      return await fetchNodeTarball(release, dir, logger, retries - 1);
+    }
+    throw err;
+  }
+  logger.stepCompleted();
+  return cachedTarballPath;
+}
+
+// Unpacked source trees are marked with the identity of the tarball they came
+// from and of the pre-compile hook that is applied to them, so that later
+// builds can re-use them (including all build outputs) instead of unpacking
+// the tarball again, which would reset file mtimes and thereby force a full
+// rebuild.
+const unpackedMarkerFile = '.boxednode-unpacked';
+
+async function isUnpackedSourceTree (sourceDir: string, treeId: string): Promise<boolean> {
+  try {
+    return await fs.readFile(path.join(sourceDir, unpackedMarkerFile), 'utf8') === treeId;
+  } catch {
+    return false;
+  }
+}
+
+async function markUnpackedSourceTree (sourceDir: string, treeId: string): Promise<void> {
+  await fs.writeFile(path.join(sourceDir, unpackedMarkerFile), treeId);
+}
+
+// Removes a source tree that boxednode has unpacked for a different tarball
+// or pre-compile hook, so that unpacking starts from a clean directory and
+// no files (e.g. preserved original sources) are carried over.
+async function removeStaleSourceTree (sourceDir: string): Promise<void> {
+  try {
+    await fs.access(path.join(sourceDir, unpackedMarkerFile));
+  } catch {
+    return;
+  }
+  await fs.rm(sourceDir, { recursive: true, force: true });
+}
+
+type NodeSourceTree = {
+  path: string,
+  // False if an existing source tree is re-used, which already contains all
+  // modifications of earlier builds (including those of the pre-compile hook).
+  isFreshlyUnpacked: boolean
+};
+
+// Download and unpack a tarball containing the code for a specific Node.js
+// version. `hookId` identifies the pre-compile hook that is going to be
+// applied to the source tree.
+async function getNodeSourceForVersion (range: string, dir: string, logger: Logger, hookId = '', retries = 2): Promise<NodeSourceTree> {
   logger.stepStarting(`Looking for Node.js version matching ${JSON.stringify(range)}`);
 
   let inputIsFileUrl = false;
@@ -28,8 +173,21 @@ async function getNodeSourceForVersion (range: string, dir: string, logger: Logg
   } catch { /* not a valid URL */ }
 
   if (inputIsFileUrl) {
-    logger.stepStarting(`Extracting tarball from ${range} to ${dir}`);
+    const tarballStat = await fs.stat(fileURLToPath(range));
+    const treeId = `${range}:${tarballStat.size}:${tarballStat.mtimeMs}:${hookId}`;
     await fs.mkdir(dir, { recursive: true });
+    const existingDirs = (await fs.readdir(dir, { withFileTypes: true })).filter(f => f.isDirectory());
+    if (existingDirs.length === 1 &&
+        await isUnpackedSourceTree(path.join(dir, existingDirs[0].name), treeId)) {
+      logger.stepStarting(`Re-using existing source tree at ${path.join(dir, existingDirs[0].name)}`);
+      logger.stepCompleted();
+      return { path: path.join(dir, existingDirs[0].name), isFreshlyUnpacked: false };
+    }
+    for (const existingDir of existingDirs) {
+      await removeStaleSourceTree(path.join(dir, existingDir.name));
+    }
+
+    logger.stepStarting(`Extracting tarball from ${range} to ${dir}`);
     await pipeline(
       createReadStream(fileURLToPath(range)),
       zlib.createGunzip(),
@@ -43,60 +201,26 @@ async function getNodeSourceForVersion (range: string, dir: string, logger: Logg
     if (dirsInDir.length !== 1) {
       throw new Error('Node.js tarballs should contain exactly one directory');
     }
-    return path.join(dir, dirsInDir[0].name);
+    await markUnpackedSourceTree(path.join(dir, dirsInDir[0].name), treeId);
+    return { path: path.join(dir, dirsInDir[0].name), isFreshlyUnpacked: true };
   }
 
-  let releaseBaseUrl: string;
-  let version: string;
-  if (range.match(/-nightly\d+/)) {
-    version = range.startsWith('v') ? range : `v${range}`;
-    releaseBaseUrl = `https://nodejs.org/download/nightly/${version}`;
-  } else {
-    const ver = (await nv(range)).pop();
-    if (!ver) {
-      throw new Error(`No node version found for ${range}`);
-    }
-    version = `v${ver.version}`;
+  const release = await resolveNodeRelease(range);
+  const { version, releaseBaseUrl, tarballName } = release;
+  const cachedTarballPath = path.join(dir, tarballName);
+  const sourceDir = path.join(dir, `node-${version}`);
+  const treeId = `${tarballName}:${hookId}`;
 
-    releaseBaseUrl = `https://nodejs.org/download/release/${version}`;
+  if (await isUnpackedSourceTree(sourceDir, treeId)) {
+    logger.stepStarting(`Re-using existing source tree at ${sourceDir}`);
+    logger.stepCompleted();
+    return { path: sourceDir, isFreshlyUnpacked: false };
   }
+  await removeStaleSourceTree(sourceDir);
 
-  const tarballName = `node-${version}.tar.gz`;
-  const cachedTarballPath = path.join(dir, tarballName);
-
-  let hasCachedTarball = false;
-  try {
-    hasCachedTarball = (await fs.stat(cachedTarballPath)).size > 0;
-  } catch {}
+  const hasCachedTarball = await verifyCachedTarball(release, cachedTarballPath, logger);
   if (hasCachedTarball) {
-    const shaSumsUrl = `${releaseBaseUrl}/SHASUMS256.txt`;
-    logger.stepStarting(`Verifying existing tarball via ${shaSumsUrl}`);
-    const [expectedSha, realSha] = await Promise.all([
-      (async () => {
-        try {
-          const shaSums = await fetch(shaSumsUrl);
-          if (!shaSums.ok) return;
-          const text = await shaSums.text();
-          for (const line of text.split('\n')) {
-            if (line.trim().endsWith(tarballName)) {
-              return line.match(/^([0-9a-fA-F]+)\b/)[0];
-            }
-          }
-        } catch {}
-      })(),
-      (async () => {
-        const hash = crypto.createHash('sha256');
-        await pipeline(createReadStream(cachedTarballPath), hash);
-        return hash.digest('hex');
-      })()
-    ]);
-    if (expectedSha === realSha) {
-      logger.stepStarting('Unpacking existing tarball');
-    } else {
-      logger.stepFailed(new Error(
-        `SHA256 mismatch: got ${realSha}, expected ${expectedSha}`));
-      hasCachedTarball = false;
-    }
+    logger.stepStarting('Unpacking existing tarball');
   }
 
   let tarballStream: Readable;
@@ -156,14 +280,15 @@ async function getNodeSourceForVersion (range: string, dir: string, logger: Logg
     if (retries > 0) {
       logger.stepFailed(err);
       logger.stepStarting('Re-trying');
-      return await getNodeSourceForVersion(range, dir, logger, retries - 1);
+      return await getNodeSourceForVersion(range, dir, logger, hookId, retries - 1);
     }
     throw err;
   }
 
+  await markUnpackedSourceTree(sourceDir, treeId);
   logger.stepCompleted();
 
-  return path.join(dir, `node-${version}`);
+  return { path: sourceDir, isFreshlyUnpacked: true };
 }
 
 async function getNodeVersionFromSourceDirectory (dir: string): Promise<[number, number, number]> {
@@ -182,7 +307,8 @@ async function compileNode (
   buildArgs: string[],
   makeArgs: string[],
   env: ProcessEnv,
-  logger: Logger): Promise<string> {
+  logger: Logger,
+  jobserver?: MakeJobserver): Promise<string> {
   logger.stepStarting('Compiling Node.js from source');
   const cpus = os.cpus().length;
   const options = {
@@ -222,18 +348,21 @@ async function compileNode (
         } catch {
           continue;
         }
-        let source = await fs.readFile(target, 'utf8');
-        source = source.replace(/-static/g, '');
-        await fs.writeFile(target, source);
+        const source = await fs.readFile(target, 'utf8');
+        await writeFileIfChanged(target, source.replace(/-static/g, ''));
       }
     }
 
     const make = ['make', ...makeArgs];
-    if (!make.some((arg) => /^-j/.test(arg))) { make.push(`-j${cpus}`); }
+    const useJobserver = jobserver && !make.some((arg) => /^-j/.test(arg));
+    if (!useJobserver && !make.some((arg) => /^-j/.test(arg))) { make.push(`-j${cpus}`); }
 
     if (!make.some((arg) => /^V=/.test(arg))) { make.push('V='); }
 
-    await spawnBuildCommand(make, options);
+    await spawnBuildCommand(make, useJobserver ? {
+      ...options,
+      ...jobserver.makeOptions(env)
+    } : options);
 
     return path.join(sourcePath, 'out', 'Release', 'node');
   } else {
@@ -263,6 +392,7 @@ type CompilationOptions = {
   nodeVersionRange: string,
   tmpdir?: string,
   sourceFile: string,
+  entryPoints?: Record<string, string>,
   targetFile: string,
   configureArgs?: string[],
   makeArgs?: string[],
@@ -275,67 +405,203 @@ type CompilationOptions = {
   useLegacyDefaultUvLoop?: boolean;
   useCodeCache?: boolean,
   useNodeSnapshot?: boolean,
+  embedModuleGraph?: boolean,
+  embeddedFiles?: string[],
   compressBlobs?: boolean,
+  cacheDecompressedBlobs?: boolean,
+  trackStartupMemory?: boolean,
+  profileRequire?: boolean,
+  opensslInit?: 'eager' | 'openssl-defaults' | 'none',
+  largePages?: 'off' | 'text',
+  runtimeCodeCache?: boolean,
+  reportFile?: string,
+  sharedLibrary?: boolean,
   nodeSnapshotConfigFlags?: string[], // e.g. 'WithoutCodeCache'
   executableMetadata?: ExecutableMetadata,
   preCompileHook?: (nodeSourceTree: string, options: CompilationOptions) => void | Promise<void>
 }
 
-async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: Logger): Promise<void> {
-  if (!options.sourceFile.endsWith('.js')) {
-    throw new Error(`Only .js files can be compiled (got: ${options.sourceFile})`);
+async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: Logger, jobserver?: MakeJobserver): Promise<void> {
+  // The default entry point is `sourceFile`, which has an empty name and is
+  // always the first one.
+  const entryPoints = [
+    { name: '', sourceFile: options.sourceFile, isModule: false },
+    ...Object.entries(options.entryPoints || {}).map(
+      ([name, sourceFile]) => ({ name, sourceFile, isModule: false }))
+  ];
+  for (const entryPoint of entryPoints) {
+    if (!['.js', '.mjs'].includes(path.extname(entryPoint.sourceFile))) {
+      throw new Error(`Only .js and .mjs files can be compiled (got: ${entryPoint.sourceFile})`);
+    }
+    // The build runs the intermediate binary as `node`, which must select
+    // the default entry point.
+    if (entryPoint !== entryPoints[0] && (!/^[\w.-]+$/.test(entryPoint.name) || entryPoint.name === 'node')) {
+      throw new Error(`Invalid entry point name: ${JSON.stringify(entryPoint.name)}`);
+    }
+    await fs.access(entryPoint.sourceFile);
+    entryPoint.isModule = await isESModuleFile(entryPoint.sourceFile);
+    if (entryPoint.isModule && options.useNodeSnapshot) {
+      throw new Error('ES module entry points cannot be used together with useNodeSnapshot');
+    }
+  }
+  if (options.runtimeCodeCache && options.useNodeSnapshot) {
+    throw new Error('runtimeCodeCache cannot be used together with useNodeSnapshot');
+  }
+  const opensslInit = options.opensslInit || 'eager';
+  if (!['eager', 'openssl-defaults', 'none'].includes(opensslInit)) {
+    throw new Error(`Invalid opensslInit value: ${JSON.stringify(opensslInit)}`);
+  }
+  if (opensslInit === 'none' && process.platform === 'win32') {
+    throw new Error('opensslInit: \'none\' is not supported on Windows');
+  }
+  const largePages = options.largePages || 'off';
+  if (!['off', 'text'].includes(largePages)) {
+    throw new Error(`Invalid largePages value: ${JSON.stringify(largePages)}`);
+  }
+  // Shared libraries must not remap the code of the host application.
+  if (largePages !== 'off' && options.sharedLibrary) {
+    throw new Error('largePages cannot be used together with sharedLibrary');
+  }
+  // The library is built as libnode with a custom name, so that the
+  // file name matches the library's soname or install name.
+  const sharedLibraryName = options.sharedLibrary
+    ? path.basename(options.targetFile).match(
+      process.platform === 'darwin' ? /^lib(.+)\.dylib$/ : /^lib(.+)\.so$/)?.[1]
+    : undefined;
+  if (options.sharedLibrary) {
+    if (process.platform === 'win32') {
+      throw new Error('sharedLibrary is not supported on Windows');
+    }
+    if (!sharedLibraryName) {
+      throw new Error(`The target file of a shared library must be named lib<name>.${
+        process.platform === 'darwin' ? 'dylib' : 'so'} (got: ${options.targetFile})`);
+    }
+    if (options.reportFile) {
+      throw new Error('reportFile cannot be used together with sharedLibrary');
+    }
   }
-  await fs.access(options.sourceFile);
 
   // We'll put the source file in a namespaced path in the target directory.
   // For example, if the file name is `myproject.js`, then it will be available
   // for importing as `require('myproject/myproject')`.
-  const namespace = options.namespace || path.basename(options.sourceFile, '.js');
+  const namespace = options.namespace || path.basename(options.sourceFile, path.extname(options.sourceFile));
   if (!options.tmpdir) {
     // We're not adding random data here, so that the paths can be part of a
     // compile caching mechanism like sccache.
     options.tmpdir = path.join(os.tmpdir(), 'boxednode', namespace);
   }
 
-  const nodeSourcePath = await getNodeSourceForVersion(
-    options.nodeVersionRange, options.tmpdir, logger);
+  // The hook is identified by its source code, so that changing it leads to
+  // a fresh source tree to which it is applied.
+  const { path: nodeSourcePath, isFreshlyUnpacked } = await getNodeSourceForVersion(
+    options.nodeVersionRange, options.tmpdir, logger,
+    options.preCompileHook ? objhash(options.preCompileHook.toString()) : '');
   const nodeVersion = await getNodeVersionFromSourceDirectory(nodeSourcePath);
+  if (options.sharedLibrary && (nodeVersion[0] < 18 || (nodeVersion[0] === 18 && nodeVersion[1] < 11))) {
+    throw new Error('sharedLibrary requires Node.js 18.11.0 or newer');
+  }
+  if (largePages !== 'off' && (nodeVersion[0] < 18 || (nodeVersion[0] === 18 && nodeVersion[1] < 11))) {
+    throw new Error(`largePages: ${JSON.stringify(largePages)} requires Node.js 18.11.0 or newer`);
+  }
 
-  const requireMappings: [RegExp, string][] = [];
+  // Require regexps, linked module names and the directory names of the
+  // addons, which are used for resolving `bindings` and `node-gyp-build` calls.
+  const requireMappings: [RegExp, string, string][] = [];
   const extraJSSourceFiles: string[] = [];
   const enableBindingsPatch = options.enableBindingsPatch ?? options.addons?.length > 0;
 
-  const jsMainSource = await fs.readFile(options.sourceFile, 'utf8');
+  const entryPointSources: { jsMainSource: string, moduleGraphSource: string }[] = [];
+  for (const entryPoint of entryPoints) {
+    const jsMainSource = await fs.readFile(entryPoint.sourceFile, 'utf8');
+    let moduleGraphSource = '';
+    // ES module entry points are always run with their module graph embedded,
+    // since they are linked by the trampoline rather than by Node.js.
+    if (entryPoint.isModule || options.embedModuleGraph || options.embeddedFiles?.length > 0) {
+      logger.stepStarting(entryPoint.name
+        ? `Collecting module graph for entry point ${entryPoint.name}`
+        : 'Collecting module graph');
+      const moduleGraph = await collectModuleGraph(
+        entryPoint.sourceFile,
+        options.embeddedFiles || [],
+        (options.addons || []).map(addon => addon.requireRegexp));
+      moduleGraphSource = JSON.stringify(moduleGraph);
+      logger.stepCompleted();
+    }
+    entryPointSources.push({ jsMainSource, moduleGraphSource });
+  }
+  const usesVMModules = entryPoints.some(entryPoint => entryPoint.isModule);
+  // Runtime code cache files are only re-used by builds with the same
+  // sources. V8 versions and flags are taken into account at runtime.
+  const runtimeCodeCacheKey = options.runtimeCodeCache
+    ? objhash([nodeVersion, namespace, entryPointSources]).slice(0, 16)
+    : '';
+  // Only the build itself can trigger startup report runs of the binary,
+  // by passing this nonce to it.
+  const startupReportNonce = options.reportFile ? crypto.randomBytes(16).toString('hex') : '';
   const registerFunctions: string[] = [];
+  const extraGypDependencies: string[] = [];
 
   // We use the official embedder API for stability, which is available in all
   // supported versions of Node.js.
   {
-    const extraGypDependencies: string[] = [];
-    for (const addon of (options.addons || [])) {
-      const addonResult = await modifyAddonGyp(
-        addon, nodeSourcePath, options.env || process.env, logger);
-      for (const { linkedModuleName, targetName, registerFunction } of addonResult) {
-        requireMappings.push([addon.requireRegexp, linkedModuleName]);
+    // Addons are prepared concurrently. With more than one addon, each of
+    // them gets a child logger, since their steps are interleaved, and they
+    // are reported within a single step of the build's logger.
+    // Addons that share a directory (and thus an addon id) are only
+    // prepared once.
+    const addons = options.addons || [];
+    const preparedAddons = new Map<string, Promise<AddonResult[]>>();
+    const childLoggers: ChildLogger[] = [];
+    if (addons.length > 1) {
+      logger.stepStarting(`Preparing ${addons.length} addons`);
+    }
+    const addonResults = await mapWithConcurrency(
+      addons,
+      Math.min(os.cpus().length, 8),
+      (addon) => {
+        const addonId = objhash(addon);
+        if (!preparedAddons.has(addonId)) {
+          const addonLogger = addons.length > 1
+            ? new ChildLogger(logger, `addon ${path.basename(addon.path)}`)
+            : logger;
+          if (addonLogger instanceof ChildLogger) childLoggers.push(addonLogger);
+          preparedAddons.set(addonId, modifyAddonGyp(
+            addon,
+            nodeSourcePath,
+            options.env || process.env,
+            addonLogger));
+        }
+        return preparedAddons.get(addonId);
+      });
+    if (addons.length > 1) {
+      logger.stepCompleted();
+      for (const childLogger of childLoggers) {
+        childLogger.flush();
+      }
+    }
+
+    for (const [i, addon] of addons.entries()) {
+      for (const { linkedModuleName, targetName, registerFunction } of addonResults[i]) {
+        requireMappings.push([addon.requireRegexp, linkedModuleName, path.basename(addon.path)]);
         extraGypDependencies.push(targetName);
         registerFunctions.push(registerFunction);
       }
     }
 
+    // All source modifications are applied to the original files and only
+    // written if they change anything, so that builds in a re-used source tree
+    // are incremental.
     logger.stepStarting('Finalizing linked addons processing');
-    const nodeGypPath = path.join(nodeSourcePath, 'node.gyp');
-    const nodeGyp = await loadGYPConfig(nodeGypPath);
-    const mainTarget = nodeGyp.targets.find(
-      (target) => ['<(node_core_target_name)', 'node'].includes(target.target_name));
-    mainTarget.dependencies = [...(mainTarget.dependencies || []), ...extraGypDependencies];
-    await storeGYPConfig(nodeGypPath, nodeGyp);
-
     for (const header of ['node.h', 'node_api.h']) {
-      const source = (
-        await fs.readFile(path.join(nodeSourcePath, 'src', header), 'utf8') +
-        await fs.readFile(path.join(__dirname, '..', 'resources', `add-${header}`), 'utf8')
-      );
-      await fs.writeFile(path.join(nodeSourcePath, 'src', header), source);
+      const headerPath = path.join(nodeSourcePath, 'src', header);
+      const addition = await fs.readFile(path.join(__dirname, '..', 'resources', `add-${header}`), 'utf8');
+      let original = await fs.readFile(await getOriginalSourceFile(headerPath), 'utf8');
+      // Source trees patched by earlier boxednode versions may already
+      // contain (possibly multiple copies of) the addition.
+      while (original.endsWith(addition)) {
+        original = original.slice(0, -addition.length);
+      }
+      await writeFileIfChanged(headerPath, original + addition);
     }
     logger.stepCompleted();
   }
@@ -346,8 +612,12 @@ async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: L
   entryPointTrampolineSource = entryPointTrampolineSource.replace(
     /\bREPLACE_WITH_BOXEDNODE_CONFIG\b/g,
     JSON.stringify({
-      requireMappings: requireMappings.map(([re, linked]) => [re.source, re.flags, linked]),
-      enableBindingsPatch
+      requireMappings: requireMappings.map(([re, linked, addonDir]) => [re.source, re.flags, linked, addonDir]),
+      enableBindingsPatch,
+      trackStartupMemory: !!options.trackStartupMemory,
+      moduleEntryPoints: entryPoints.filter(({ isModule }) => isModule).map(({ name }) => name),
+      startupReport: !!options.reportFile,
+      profileRequire: !!options.profileRequire
     }));
 
   /**
@@ -371,20 +641,30 @@ async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: L
     };
 
   await fs.mkdir(path.dirname(customCodeSource), { recursive: true });
-  await fs.writeFile(customCodeSource, entryPointTrampolineSource);
+  await writeFileIfChanged(customCodeSource, entryPointTrampolineSource);
   extraJSSourceFiles.push(customCodeConfigureParam);
   logger.stepCompleted();
 
   logger.stepStarting('Storing executable metadata');
   const resPath = path.join(nodeSourcePath, 'src', 'res');
-  await fs.writeFile(
+  await writeFileIfChanged(
     path.join(resPath, 'node.rc'),
     await generateRCFile(resPath, options.targetFile, options.executableMetadata));
   logger.stepCompleted();
 
-  if (options.preCompileHook) {
+  // Re-used source trees already contain the changes of the hook, which
+  // must not be applied twice.
+  if (options.preCompileHook && isFreshlyUnpacked) {
     logger.stepStarting('Running pre-compile hook');
     await options.preCompileHook(nodeSourcePath, options);
+    // Later builds patch the headers from their preserved original contents,
+    // which therefore need to include the changes of the hook.
+    for (const header of ['node.h', 'node_api.h']) {
+      const headerPath = path.join(nodeSourcePath, 'src', header);
+      const addition = await fs.readFile(path.join(__dirname, '..', 'resources', `add-${header}`), 'utf8');
+      const hooked = await fs.readFile(headerPath, 'utf8');
+      await fs.writeFile(await getOriginalSourceFile(headerPath), hooked.replace(addition, ''));
+    }
     logger.stepCompleted();
   }
 
@@ -392,17 +672,74 @@ async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: L
     ? createCompressedBlobDefinition
     : createUncompressedBlobDefinition;
 
+  // Code caches and snapshots are generated and embedded per entry point.
+  // Linked addons are added to the executable, or to libnode when building
+  // the shared library, which then also contains the boxednode code.
+  async function writeNodeGyp (library: boolean): Promise<void> {
+    const nodeGypPath = path.join(nodeSourcePath, 'node.gyp');
+    const nodeGyp = await loadGYPConfig(await getOriginalSourceFile(nodeGypPath));
+    const mainTarget = nodeGyp.targets.find(
+      (target) => ['<(node_core_target_name)', 'node'].includes(target.target_name));
+    const libTarget = nodeGyp.targets.find(
+      (target) => ['<(node_lib_target_name)', 'libnode'].includes(target.target_name));
+    const target = library ? libTarget : mainTarget;
+    target.dependencies = [...new Set([...(target.dependencies || []), ...extraGypDependencies])];
+    if (library) {
+      target.sources = [...(target.sources || []), 'src/boxednode_library.cc'];
+    }
+    if (sharedLibraryName) {
+      // Later conditions take precedence over the ones in node.gyp.
+      libTarget.conditions = [...(libTarget.conditions || []), ['node_shared=="true"', {
+        product_name: sharedLibraryName,
+        product_extension: process.platform === 'darwin' ? 'dylib' : 'so',
+        xcode_settings: {
+          LD_DYLIB_INSTALL_NAME: `@rpath/${path.basename(options.targetFile)}`
+        }
+      }]];
+    }
+    await storeGYPConfig(nodeGypPath, nodeGyp);
+  }
+
+  const sharedLibraryPath = path.join(
+    nodeSourcePath, 'out', 'Release', process.platform === 'darwin' ? '' : 'lib.target',
+    path.basename(options.targetFile));
+
   async function writeMainFileAndCompile ({
-    codeCacheBlob = new Uint8Array(0),
+    codeCacheBlobs = [],
     codeCacheMode = 'ignore',
-    snapshotBlob = new Uint8Array(0),
-    snapshotMode = 'ignore'
+    snapshotBlobs = [],
+    snapshotMode = 'ignore',
+    library = false
   }: {
-    codeCacheBlob?: Uint8Array,
+    codeCacheBlobs?: Uint8Array[],
     codeCacheMode?: 'ignore' | 'generate' | 'consume',
-    snapshotBlob?: Uint8Array,
-    snapshotMode?: 'ignore' | 'generate' | 'consume'
+    snapshotBlobs?: Uint8Array[],
+    snapshotMode?: 'ignore' | 'generate' | 'consume',
+    library?: boolean
   } = {}): Promise<string> {
+    const entryPointDefinitions: string[] = [
+      `const char* const kBoxednodeEntryPointNames[] = { ${entryPoints.map(({ name }) => JSON.stringify(name)).join(', ')} };`,
+      `const size_t kBoxednodeEntryPointCount = ${entryPoints.length};`
+    ];
+    for (const [i, { jsMainSource, moduleGraphSource }] of entryPointSources.entries()) {
+      entryPointDefinitions.push(
+        createCppJsStringDefinition(`GetBoxednodeMainScriptSource_${i}`, snapshotMode !== 'consume' ? jsMainSource : ''),
+        createCppJsStringDefinition(`GetBoxednodeModuleGraphSource_${i}`, snapshotMode !== 'consume' ? moduleGraphSource : ''),
+        await createBlobDefinition(`GetBoxednodeCodeCache_${i}`, codeCacheBlobs[i] ?? new Uint8Array(0)),
+        await createBlobDefinition(`GetBoxednodeSnapshotBlob_${i}`, snapshotBlobs[i] ?? new Uint8Array(0)));
+    }
+    const dispatch = (returnType: string, prefix: string, suffix: string, params = '', args = '') =>
+      createEntryPointDispatchDefinition(returnType, prefix, suffix, params, args, entryPoints.length);
+    entryPointDefinitions.push(
+      dispatch('Local<String>', 'GetBoxednodeMainScriptSource', '', 'Isolate* isolate', 'isolate'),
+      dispatch('Local<String>', 'GetBoxednodeModuleGraphSource', '', 'Isolate* isolate', 'isolate'),
+      dispatch('Local<Uint8Array>', 'GetBoxednodeCodeCache', 'Buffer', 'Isolate* isolate', 'isolate'),
+      dispatch('std::shared_ptr<BackingStore>', 'GetBoxednodeCodeCache', 'BackingStore'),
+      dispatch('std::vector<char>', 'GetBoxednodeSnapshotBlob', 'Vector'),
+      '#ifdef NODE_VERSION_SUPPORTS_STRING_VIEW_SNAPSHOT',
+      dispatch('std::optional<std::string_view>', 'GetBoxednodeSnapshotBlob', 'SV'),
+      '#endif');
+
     logger.stepStarting('Handling main file source');
     let mainSource = await fs.readFile(
       path.join(__dirname, '..', 'resources', 'main-template.cc'), 'utf8');
@@ -413,11 +750,33 @@ async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: L
     mainSource = mainSource.replace(/\bREPLACE_DEFINE_LINKED_MODULES\b/g,
       registerFunctions.map((fn) => `${fn},`).join(''));
     mainSource = mainSource.replace(/\bREPLACE_WITH_MAIN_SCRIPT_SOURCE_GETTER\b/g,
-      createCppJsStringDefinition('GetBoxednodeMainScriptSource', snapshotMode !== 'consume' ? jsMainSource : '') + '\n' +
-      await createBlobDefinition('GetBoxednodeCodeCache', codeCacheBlob) + '\n' +
-      await createBlobDefinition('GetBoxednodeSnapshotBlob', snapshotBlob));
+      entryPointDefinitions.join('\n'));
     mainSource = mainSource.replace(/\bBOXEDNODE_CODE_CACHE_MODE\b/g,
       JSON.stringify(codeCacheMode));
+    if (options.trackStartupMemory) {
+      mainSource = `#define BOXEDNODE_TRACK_STARTUP_MEMORY 1\n${mainSource}`;
+    }
+    if (usesVMModules) {
+      mainSource = `#define BOXEDNODE_USE_VM_MODULES 1\n${mainSource}`;
+    }
+    if (runtimeCodeCacheKey) {
+      mainSource = `#define BOXEDNODE_RUNTIME_CODE_CACHE_KEY ${JSON.stringify(runtimeCodeCacheKey)}\n${mainSource}`;
+    }
+    if (options.reportFile) {
+      mainSource = `#define BOXEDNODE_STARTUP_REPORT 1\n#define BOXEDNODE_STARTUP_REPORT_NONCE ${JSON.stringify(startupReportNonce)}\n${mainSource}`;
+    }
+    if (library) {
+      mainSource = `#define BOXEDNODE_LIBRARY 1\n${mainSource}`;
+    }
+    if (opensslInit === 'openssl-defaults') {
+      mainSource = `#define BOXEDNODE_OPENSSL_DEFAULTS 1\n${mainSource}`;
+    }
+    if (largePages !== 'off') {
+      mainSource = `#define BOXEDNODE_LARGE_PAGES 1\n${mainSource}`;
+    }
+    if (options.compressBlobs && options.cacheDecompressedBlobs) {
+      mainSource = `#define BOXEDNODE_CACHE_DECOMPRESSED_BLOBS 1\n${mainSource}`;
+    }
     if (options.useLegacyDefaultUvLoop) {
       mainSource = `#define BOXEDNODE_USE_DEFAULT_UV_LOOP 1\n${mainSource}`;
     }
@@ -427,6 +786,9 @@ async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: L
     if (snapshotMode === 'consume') {
       mainSource = `#define BOXEDNODE_CONSUME_SNAPSHOT 1\n${mainSource}`;
     }
+    if (codeCacheMode === 'consume' && codeCacheBlobs.every(blob => blob.length > 0) && !library) {
+      mainSource = `#define BOXEDNODE_PREFETCH_CODE_CACHE 1\n${mainSource}`;
+    }
     if (options.nodeSnapshotConfigFlags) {
       const flags = [
         '0',
@@ -435,21 +797,41 @@ async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: L
       ].join(' | ');
       mainSource = `#define BOXEDNODE_SNAPSHOT_CONFIG_FLAGS (static_cast<SnapshotFlags>(${flags}))\n${mainSource}`;
     }
-    await fs.writeFile(path.join(nodeSourcePath, 'src', 'node_main.cc'), mainSource);
+    const nodeMainPath = path.join(nodeSourcePath, 'src', 'node_main.cc');
+    const originalNodeMainPath = await getOriginalSourceFile(nodeMainPath);
+    if (library) {
+      // The node executable is built from its original source alongside the
+      // library.
+      await writeFileIfChanged(nodeMainPath, await fs.readFile(originalNodeMainPath));
+      await writeFileIfChanged(path.join(nodeSourcePath, 'src', 'boxednode_library.cc'), mainSource);
+      await writeFileIfChanged(path.join(nodeSourcePath, 'src', 'boxednode.h'),
+        await fs.readFile(path.join(__dirname, '..', 'resources', 'boxednode.h')));
+    } else {
+      await writeFileIfChanged(nodeMainPath, mainSource);
+    }
+    await writeNodeGyp(library);
     logger.stepCompleted();
 
-    return await compileNode(
+    const configureArgs = [...(options.configureArgs || [])];
+    if (opensslInit === 'none') configureArgs.push('--without-ssl');
+    // All builds share the same configuration, so that switching between
+    // the executable for generating blobs and the library is incremental.
+    if (options.sharedLibrary) configureArgs.push('--shared');
+    const binaryPath = await compileNode(
       nodeSourcePath,
       extraJSSourceFiles,
-      options.configureArgs,
+      configureArgs,
       options.makeArgs,
       options.env || process.env,
-      logger);
+      logger,
+      jobserver);
+    return library ? sharedLibraryPath : binaryPath;
   }
 
   let binaryPath: string;
+  const results: Uint8Array[] = [];
   if (!options.useCodeCache && !options.useNodeSnapshot) {
-    binaryPath = await writeMainFileAndCompile();
+    binaryPath = await writeMainFileAndCompile({ library: options.sharedLibrary });
   } else {
     binaryPath = await writeMainFileAndCompile({
       codeCacheMode: options.useNodeSnapshot ? 'ignore' : 'generate',
@@ -457,27 +839,69 @@ async function compileJSFileAsBinaryImpl (options: CompilationOptions, logger: L
     });
     const intermediateFile = path.join(nodeSourcePath, 'intermediate.out');
     logger.stepStarting('Running code cache/snapshot generation');
-    await fs.rm(intermediateFile, { force: true });
-    await promisify(execFile)(binaryPath, { cwd: nodeSourcePath });
-    const result = await fs.readFile(intermediateFile);
-    if (result.length === 0) {
-      throw new Error('Empty code cache/snapshot result');
+    for (const { name } of entryPoints) {
+      // Named entry points are selected like subcommands.
+      await fs.rm(intermediateFile, { force: true });
+      await promisify(execFile)(binaryPath, name ? [name] : [], {
+        cwd: nodeSourcePath,
+        // With sharedLibrary, the executable is linked against libnode.
+        env: options.sharedLibrary ? {
+          ...process.env,
+          LD_LIBRARY_PATH: path.dirname(sharedLibraryPath),
+          DYLD_LIBRARY_PATH: path.dirname(sharedLibraryPath)
+        } : process.env
+      });
+      const result = await fs.readFile(intermediateFile);
+      if (result.length === 0) {
+        throw new Error(`Empty code cache/snapshot result${name ? ` for entry point ${name}` : ''}`);
+      }
+      results.push(result);
     }
     logger.stepCompleted();
     binaryPath = await writeMainFileAndCompile(options.useNodeSnapshot ? {
-      snapshotBlob: result,
-      snapshotMode: 'consume'
+      snapshotBlobs: results,
+      snapshotMode: 'consume',
+      library: options.sharedLibrary
     } : {
-      codeCacheBlob: result,
-      codeCacheMode: 'consume'
+      codeCacheBlobs: results,
+      codeCacheMode: 'consume',
+      library: options.sharedLibrary
     });
   }
 
   logger.stepStarting(`Moving resulting binary to ${options.targetFile}`);
   await fs.mkdir(path.dirname(options.targetFile), { recursive: true });
   await fs.copyFile(binaryPath, options.targetFile);
+  if (options.sharedLibrary) {
+    await fs.copyFile(
+      path.join(__dirname, '..', 'resources', 'boxednode.h'),
+      path.join(path.dirname(options.targetFile), 'boxednode.h'));
+  }
   logger.stepCompleted();
 
+  if (options.reportFile) {
+    logger.stepStarting(`Writing build report to ${options.reportFile}`);
+    const report = await createBuildReport({
+      binaryPath: options.targetFile,
+      startupReportNonce,
+      nodeSourcePath,
+      nodeVersion: nodeVersion.join('.'),
+      compressBlobs: !!options.compressBlobs,
+      addonTargets: [...new Set(extraGypDependencies)],
+      entryPoints: entryPoints.map(({ name }, i) => ({
+        name,
+        // Sources are not embedded when using a snapshot.
+        jsMainSource: options.useNodeSnapshot ? '' : entryPointSources[i].jsMainSource,
+        moduleGraphSource: options.useNodeSnapshot ? '' : entryPointSources[i].moduleGraphSource,
+        codeCacheBlob: !options.useNodeSnapshot && results[i] || new Uint8Array(),
+        snapshotBlob: options.useNodeSnapshot && results[i] || new Uint8Array()
+      }))
+    });
+    await fs.mkdir(path.dirname(options.reportFile), { recursive: true });
+    await fs.writeFile(options.reportFile, JSON.stringify(report, null, 2));
+    logger.stepCompleted();
+  }
+
   if (options.clean) {
     logger.stepStarting('Cleaning temporary directory');
     await promisify(rimraf)(options.tmpdir, { glob: false });
@@ -496,23 +920,147 @@ function parseEnvVarArgList (value: string | undefined): string[] {
   }
 }
 
-export async function compileJSFileAsBinary (options: Readonly<CompilationOptions>): Promise<void> {
-  const logger = options.logger || new LoggerImpl();
-
+// Apply extra configure and make arguments from the environment.
+function withEnvVarBuildArgs (options: Readonly<CompilationOptions>): CompilationOptions {
   const configureArgs = [...(options.configureArgs || [])];
   configureArgs.push(...parseEnvVarArgList(process.env.BOXEDNODE_CONFIGURE_ARGS));
 
   const makeArgs = [...(options.makeArgs || [])];
   makeArgs.push(...parseEnvVarArgList(process.env.BOXEDNODE_MAKE_ARGS));
 
+  return {
+    ...options,
+    configureArgs,
+    makeArgs
+  };
+}
+
+export async function compileJSFileAsBinary (options: Readonly<CompilationOptions>): Promise<void> {
+  const logger = options.logger || new LoggerImpl();
+
   try {
-    await compileJSFileAsBinaryImpl({
-      ...options,
-      configureArgs,
-      makeArgs
-    }, logger);
+    await compileJSFileAsBinaryImpl(withEnvVarBuildArgs(options), logger);
   } catch (err) {
     logger.stepFailed(err);
     throw err;
   }
 }
+
+type MultiTargetCompilationOptions = {
+  jobs?: number,
+  maxConcurrentTargets?: number,
+  tarballDir?: string
+};
+
+// Build multiple binaries at once, e.g. for several Node.js versions or
+// configure variants. Targets that only differ in their target file are
+// compiled once, each Node.js release is downloaded once, and all `make`
+// processes share a single jobserver so that the total number of compile
+// jobs stays close to `jobs` (the number of CPUs by default).
+export async function compileJSFileAsBinaries (
+  targets: readonly Readonly<CompilationOptions>[],
+  multiTargetOptions: Readonly<MultiTargetCompilationOptions> = {}): Promise<void> {
+  const sharedDir = path.join(os.tmpdir(), 'boxednode');
+  const tarballDir = multiTargetOptions.tarballDir ?? path.join(sharedDir, 'tarballs');
+
+  // Group targets by everything that affects the generated binary. Only
+  // whether there is a report file matters for the binary itself; the report
+  // is copied for duplicate targets.
+  const preCompileHooks: CompilationOptions['preCompileHook'][] = [];
+  const groups = new Map<string, Readonly<CompilationOptions>[]>();
+  for (const target of targets) {
+    if (!preCompileHooks.includes(target.preCompileHook)) {
+      preCompileHooks.push(target.preCompileHook);
+    }
+    const key = objhash({
+      ...target,
+      targetFile: undefined,
+      reportFile: !!target.reportFile,
+      logger: undefined,
+      clean: undefined,
+      addons: target.addons?.map(addon =>
+        [addon.path, addon.requireRegexp.source, addon.requireRegexp.flags]),
+      preCompileHook: preCompileHooks.indexOf(target.preCompileHook)
+    });
+    groups.set(key, [...(groups.get(key) || []), target]);
+  }
+  // Distinct builds cannot share a source tree, since they would modify and
+  // compile it concurrently.
+  const explicitTmpdirs = new Map<string, string>();
+  for (const [key, [primary]] of groups) {
+    if (!primary.tmpdir) continue;
+    const tmpdir = path.resolve(primary.tmpdir);
+    if (explicitTmpdirs.has(tmpdir)) {
+      throw new Error(`Targets ${explicitTmpdirs.get(tmpdir)} and ${primary.targetFile} ` +
+        `produce different binaries and cannot share the tmpdir ${primary.tmpdir}`);
+    }
+    explicitTmpdirs.set(tmpdir, primary.targetFile);
+  }
+
+  const tarballs = new Map<string, Promise<string>>();
+  async function getSharedTarballUrl (range: string, logger: Logger): Promise<string> {
+    try {
+      if (new URL(range).protocol === 'file:') return range;
+    } catch { /* not a valid URL */ }
+    logger.stepStarting(`Looking for Node.js version matching ${JSON.stringify(range)}`);
+    const release = await resolveNodeRelease(range);
+    if (!tarballs.has(release.tarballName)) {
+      tarballs.set(release.tarballName, fetchNodeTarball(release, tarballDir, logger));
+    }
+    const tarball = await tarballs.get(release.tarballName);
+    logger.stepCompleted();
+    return pathToFileURL(tarball).href;
+  }
+
+  const jobserver = await MakeJobserver.create(
+    multiTargetOptions.jobs ?? os.cpus().length, sharedDir);
+  const failures: Error[] = [];
+  try {
+    await mapWithConcurrency(
+      [...groups],
+      multiTargetOptions.maxConcurrentTargets ?? groups.size,
+      async ([key, [primary, ...duplicates]]) => {
+        const logger = primary.logger || new TargetLoggerImpl(path.basename(primary.targetFile));
+        try {
+          const namespace = primary.namespace || path.basename(primary.sourceFile, path.extname(primary.sourceFile));
+          await compileJSFileAsBinaryImpl(withEnvVarBuildArgs({
+            ...primary,
+            nodeVersionRange: await getSharedTarballUrl(primary.nodeVersionRange, logger),
+            // Every distinct build needs its own source tree.
+            tmpdir: primary.tmpdir ?? path.join(sharedDir, `${namespace}-${key.slice(0, 8)}`)
+          }), logger, jobserver);
+
+          // Duplicates get the same artifacts as the primary target.
+          for (const { targetFile, reportFile } of duplicates) {
+            logger.stepStarting(`Copying resulting binary to ${targetFile}`);
+            await fs.mkdir(path.dirname(targetFile), { recursive: true });
+            await fs.copyFile(primary.targetFile, targetFile);
+            if (primary.sharedLibrary && path.resolve(path.dirname(targetFile)) !== path.resolve(path.dirname(primary.targetFile))) {
+              await fs.copyFile(
+                path.join(path.dirname(primary.targetFile), 'boxednode.h'),
+                path.join(path.dirname(targetFile), 'boxednode.h'));
+            }
+            if (reportFile && path.resolve(reportFile) !== path.resolve(primary.reportFile)) {
+              await fs.mkdir(path.dirname(reportFile), { recursive: true });
+              await fs.copyFile(primary.reportFile, reportFile);
+            }
+            logger.stepCompleted();
+          }
+        } catch (err) {
+          logger.stepFailed(err);
+          failures.push(err);
+        }
+        if (logger instanceof TargetLoggerImpl) {
+          logger.printSummary();
+        }
+      });
+  } finally {
+    await jobserver?.close();
+  }
+
+  if (failures.length > 0) {
+    throw Object.assign(
+      new Error(`${failures.length} of ${groups.size} builds failed: ${failures.map(err => err.message).join('; ')}`),
+      { errors: failures });
+  }
+}
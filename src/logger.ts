@@ -7,6 +7,9 @@ export interface Logger {
   stepFailed(err: Error): void;
   startProgress(maximum: number): void;
   doProgress(current: number): void;
+  // Prints a message without starting or completing a step. Optional for
+  // custom loggers.
+  log?(message: string): void;
 }
 
 export class LoggerImpl implements Logger {
@@ -48,4 +51,116 @@ export class LoggerImpl implements Logger {
   doProgress (current: number): void {
     this.cliProgress.update(current);
   }
+
+  log (message: string): void {
+    console.warn(`  ${chalk.gray('·')}  ${message}`);
+  }
+}
+
+// Logger for one of several concurrently running tasks, e.g. one target of a
+// multi-target build. Messages are prefixed with the task name, progress bars
+// are suppressed since several tasks log at the same time, and the duration
+// of each step is recorded and printed.
+export class TargetLoggerImpl implements Logger {
+  readonly stepTimings: [string, number][] = [];
+  private currentStep = '';
+  private currentStepStart = 0;
+
+  constructor (private readonly target: string) {}
+
+  stepStarting (info: string): void {
+    if (this.currentStep) {
+      this.stepCompleted();
+    }
+    this.currentStep = info;
+    this.currentStepStart = Date.now();
+    console.warn(`${chalk.cyan(`[${this.target}]`)} ${chalk.yellow('→')}  ${info} ...`);
+  }
+
+  _stepDone (): number {
+    const duration = (Date.now() - this.currentStepStart) / 1000;
+    if (this.currentStep) {
+      this.stepTimings.push([this.currentStep, duration]);
+    }
+    this.currentStep = '';
+    return duration;
+  }
+
+  stepCompleted (): void {
+    const doneText = this.currentStep;
+    const duration = this._stepDone();
+    console.warn(`${chalk.cyan(`[${this.target}]`)} ${chalk.green(`  ✓  Completed: ${doneText} (${duration.toFixed(1)}s)`)}`);
+  }
+
+  stepFailed (err: Error): void {
+    const duration = this._stepDone();
+    console.warn(`${chalk.cyan(`[${this.target}]`)} ${chalk.red(`  ✖  Failed: ${err.message} (${duration.toFixed(1)}s)`)}`);
+  }
+
+  startProgress (): void {}
+  doProgress (): void {}
+
+  log (message: string): void {
+    console.warn(`${chalk.cyan(`[${this.target}]`)}   ${chalk.gray('·')}  ${message}`);
+  }
+
+  printSummary (): void {
+    const total = this.stepTimings.reduce((sum, [, duration]) => sum + duration, 0);
+    console.warn(`${chalk.cyan(`[${this.target}]`)} Step timings (total ${total.toFixed(1)}s):`);
+    for (const [step, duration] of this.stepTimings) {
+      console.warn(`${chalk.cyan(`[${this.target}]`)}   ${duration.toFixed(1).padStart(8)}s  ${step}`);
+    }
+  }
+}
+
+// Logger for one of several concurrently running sub-tasks of a build, e.g.
+// preparing one of several addons. Since the steps of sub-tasks are
+// interleaved, each step is reported once it has completed or failed,
+// prefixed with the sub-task name and its duration. Reports go through the
+// parent's log() method, so that the parent's current step is not affected.
+// Parents without one get the reports through flush(), which must be called
+// while the parent has no open step.
+export class ChildLogger implements Logger {
+  private currentStep = '';
+  private currentStepStart = 0;
+  private readonly pendingReports: string[] = [];
+
+  constructor (private readonly parent: Logger, private readonly name: string) {}
+
+  stepStarting (info: string): void {
+    if (this.currentStep) {
+      this.stepCompleted();
+    }
+    this.currentStep = info;
+    this.currentStepStart = Date.now();
+  }
+
+  _report (suffix: string): void {
+    const duration = (Date.now() - this.currentStepStart) / 1000;
+    const report = `[${this.name}] ${this.currentStep}${suffix} (${duration.toFixed(1)}s)`;
+    this.currentStep = '';
+    if (this.parent.log) {
+      this.parent.log(report);
+    } else {
+      this.pendingReports.push(report);
+    }
+  }
+
+  stepCompleted (): void {
+    this._report('');
+  }
+
+  stepFailed (err: Error): void {
+    this._report(` failed: ${err.message}`);
+  }
+
+  startProgress (): void {}
+  doProgress (): void {}
+
+  flush (): void {
+    for (const report of this.pendingReports.splice(0)) {
+      this.parent.stepStarting(report);
+      this.parent.stepCompleted();
+    }
+  }
 }
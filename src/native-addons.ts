@@ -1,11 +1,10 @@
 /* eslint-disable dot-notation */
-import { randomBytes } from 'crypto';
 import { promises as fs } from 'fs';
 import { parse } from 'gyp-parser';
 import path from 'path';
 import pkgUp from 'pkg-up';
 import { Logger } from './logger';
-import { copyRecursive, ProcessEnv, objhash, spawnBuildCommand, npm } from './helpers';
+import { copyRecursive, ProcessEnv, objhash, spawnBuildCommand, npm, writeFileIfChanged, directoryFingerprint } from './helpers';
 
 export type AddonConfig = {
   path: string,
@@ -24,6 +23,8 @@ type GypConfig = {
   ['defines!']?: string[],
   type?: string,
   dependencies?: string[],
+  sources?: string[],
+  conditions?: unknown[],
   ['target_name']?: string,
   includes?: string[],
   variables?: Record<string, string>
@@ -38,7 +39,7 @@ export async function loadGYPConfig (filename: string): Promise<GypConfig> {
 }
 
 export async function storeGYPConfig (filename: string, config: GypConfig): Promise<void> {
-  return await fs.writeFile(filename, JSON.stringify(config, null, '  '));
+  await writeFileIfChanged(filename, JSON.stringify(config, null, '  '));
 }
 
 function turnIntoStaticLibrary (config: GypConfig, addonId: string): AddonResult[] {
@@ -63,7 +64,9 @@ function turnIntoStaticLibrary (config: GypConfig, addonId: string): AddonResult
       'BUILDING_BOXEDNODE_EXTENSION',
       `BOXEDNODE_REGISTER_FUNCTION=${registerFunction}`,
       `BOXEDNODE_MODULE_NAME=${linkedModuleName}`,
-      `NAPI_CPP_CUSTOM_NAMESPACE=i${randomBytes(12).toString('hex')}`
+      // Deterministic, so that the generated .gyp file stays unchanged
+      // between builds of the same addon.
+      `NAPI_CPP_CUSTOM_NAMESPACE=i${objhash([addonId, target.target_name]).slice(0, 24)}`
     ]) {
       negDefines.delete(want);
       posDefines.add(want);
@@ -114,17 +117,34 @@ export async function modifyAddonGyp (
   nodeSourcePath: string,
   env: ProcessEnv,
   logger: Logger): Promise<AddonResult[]> {
-  logger.stepStarting(`Copying addon at ${addon.path}`);
   const addonId = objhash(addon);
   const addonPath = path.resolve(nodeSourcePath, 'deps', addonId);
-  await copyRecursive(addon.path, addonPath);
-  logger.stepCompleted();
 
-  await spawnBuildCommand([...npm(), 'install', '--ignore-scripts', '--production'], {
-    cwd: addonPath,
-    logger,
-    env
-  });
+  // Copying the addon and installing its dependencies is skipped if the
+  // addon's contents have not changed since the last build in this tree.
+  const preparedStateFile = path.resolve(addonPath, '.boxednode-prepared');
+  const preparedState = await directoryFingerprint(addon.path);
+  let isPrepared = false;
+  try {
+    isPrepared = await fs.readFile(preparedStateFile, 'utf8') === preparedState;
+  } catch { /* not prepared yet */ }
+
+  if (isPrepared) {
+    logger.stepStarting(`Re-using prepared addon at ${addon.path}`);
+    logger.stepCompleted();
+  } else {
+    logger.stepStarting(`Copying addon at ${addon.path}`);
+    await fs.rm(addonPath, { recursive: true, force: true });
+    await copyRecursive(addon.path, addonPath);
+    logger.stepCompleted();
+
+    await spawnBuildCommand([...npm(), 'install', '--ignore-scripts', '--production'], {
+      cwd: addonPath,
+      logger,
+      env
+    });
+    await fs.writeFile(preparedStateFile, preparedState);
+  }
 
   logger.stepStarting(`Preparing addon at ${addon.path}`);
   const sourceGYP = path.resolve(addonPath, 'binding.gyp');
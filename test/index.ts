@@ -1,4 +1,4 @@
-import { compileJSFileAsBinary } from '..';
+import { compileJSFileAsBinary, compileJSFileAsBinaries } from '..';
 import path from 'path';
 import os from 'os';
 import assert from 'assert';
@@ -11,6 +11,17 @@ import { promises as fs } from 'fs';
 const execFile = promisify(childProcess.execFile);
 const exeSuffix = process.platform === 'win32' ? '.exe' : '';
 
+// Median wall-clock time in milliseconds for running `file` to completion.
+async function medianStartupTime (file: string, args: string[] = []): Promise<number> {
+  const durations: number[] = [];
+  for (let i = 0; i < 11; i++) {
+    const start = process.hrtime.bigint();
+    await execFile(file, args, { encoding: 'utf8' });
+    durations.push(Number(process.hrtime.bigint() - start) / 1e6);
+  }
+  return durations.sort((a, b) => a - b)[5];
+}
+
 describe('basic functionality', () => {
   // Test the currently running Node.js version. Other versions can be checked
   // manually that way, or through the CI matrix.
@@ -111,6 +122,370 @@ describe('basic functionality', () => {
       }
     });
 
+    it('works with the default OpenSSL configuration', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const targetFile = path.resolve(__dirname, `resources/example${exeSuffix}`);
+      // Median time spent in InitializeOncePerProcess, in the units of
+      // getTimingData().
+      const medianInitTime = async (): Promise<number> => {
+        const durations: number[] = [];
+        for (let i = 0; i < 11; i++) {
+          const { stdout } = await execFile(
+            targetFile, ['JSON.stringify(process.boxednode.getTimingData())'],
+            { encoding: 'utf8' });
+          const timingData: [string, string, number][] = JSON.parse(stdout);
+          const time = (label: string) => timingData.find(([, l]) => l === label)[2];
+          durations.push(time('Finished InitializeOncePerProcess') - time('Start InitializeOncePerProcess'));
+        }
+        return durations.sort((a, b) => a - b)[5];
+      };
+      // A configuration file that OpenSSL cannot parse.
+      const brokenConfigFile = path.join(os.tmpdir(), 'boxednode-broken-openssl.cnf');
+      await fs.writeFile(brokenConfigFile, 'openssl_conf = openssl_init\n[openssl_init\n');
+
+      await compileJSFileAsBinary({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile
+      });
+      const eagerInitTime = await medianInitTime();
+      if (semver.gte(version, '17.0.0')) {
+        // Node.js loads OPENSSL_CONF during startup, so errors surface early.
+        await assert.rejects(
+          execFile(targetFile, ['0'], { env: { ...process.env, OPENSSL_CONF: brokenConfigFile } }),
+          (err: any) => /OpenSSL configuration error/.test(err.stderr));
+      }
+
+      await compileJSFileAsBinary({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        opensslInit: 'openssl-defaults'
+      });
+
+      {
+        const { stdout } = await execFile(
+          targetFile, [
+            'require("crypto").createHash("sha256").update("boxednode").digest("hex")'
+          ],
+          { encoding: 'utf8' });
+        assert.strictEqual(stdout, '7988e63526218d0b7ac66fb1df2d2ffa41269b3e1967f8f50ee4dd7ccf0626fe\n');
+      }
+
+      {
+        const { stdout } = await execFile(targetFile, ['require("crypto").getFips()'], { encoding: 'utf8' });
+        assert.strictEqual(stdout, '0\n');
+      }
+
+      // Anything that would configure OpenSSL is rejected rather than ignored.
+      for (const [env, name] of [
+        [{ OPENSSL_CONF: brokenConfigFile }, 'OPENSSL_CONF'],
+        [{ NODE_EXTRA_CA_CERTS: brokenConfigFile }, 'NODE_EXTRA_CA_CERTS'],
+        [{ NODE_OPTIONS: '--force-fips' }, '--force-fips'],
+        [{ NODE_OPTIONS: `--openssl-config=${brokenConfigFile}` }, '--openssl-config']
+      ] as [Record<string, string>, string][]) {
+        await assert.rejects(
+          execFile(targetFile, ['0'], { env: { ...process.env, ...env } }),
+          (err: any) => err.stderr.includes(`${name} is not supported`));
+      }
+
+      const defaultsInitTime = await medianInitTime();
+      console.log('Median InitializeOncePerProcess time:', { eager: eagerInitTime, defaults: defaultsInitTime });
+      // Loading the OpenSSL 3 configuration is the expensive part of eager
+      // initialization; with OpenSSL 1.1, there is little to save.
+      if (semver.gte(version, '17.0.0')) {
+        assert(defaultsInitTime < eagerInitTime,
+          `Skipping OpenSSL initialization did not save time: ${defaultsInitTime} vs. ${eagerInitTime}`);
+      }
+    });
+
+    it('rebuilds incrementally when only the JS source changes', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const options = {
+        nodeVersionRange: version,
+        namespace: 'example',
+        targetFile: path.resolve(__dirname, `resources/example${exeSuffix}`)
+      };
+      await compileJSFileAsBinary({
+        ...options,
+        sourceFile: path.resolve(__dirname, 'resources/example.js')
+      });
+
+      // Object files that the rebuild writes, relative to the build output
+      // directory. Windows builds always start from a clean output directory.
+      const objectDir = path.join(os.tmpdir(), 'boxednode', 'example', `node-v${version}`, 'out', 'Release', 'obj.target');
+      const listObjectFiles = async (dir: string, since: number): Promise<string[]> => {
+        const files: string[] = [];
+        for (const entry of await fs.readdir(dir, { withFileTypes: true })) {
+          const file = path.join(dir, entry.name);
+          if (entry.isDirectory()) {
+            files.push(...await listObjectFiles(file, since));
+          } else if (entry.name.endsWith('.o') && (await fs.stat(file)).mtimeMs >= since) {
+            files.push(path.relative(objectDir, file));
+          }
+        }
+        return files;
+      };
+
+      const tmpdir = await fs.mkdtemp(path.join(os.tmpdir(), 'boxednode-test-'));
+      try {
+        const changedSourceFile = path.join(tmpdir, 'example.js');
+        await fs.writeFile(changedSourceFile, 'console.log("Changed!");');
+        const start = Date.now();
+        await compileJSFileAsBinary({
+          ...options,
+          sourceFile: changedSourceFile
+        });
+        // Only node_main.cc needs to be recompiled, followed by linking.
+        if (process.platform !== 'win32') {
+          assert.deepStrictEqual(
+            await listObjectFiles(objectDir, start),
+            [path.join('node', 'src', 'node_main.o')]);
+        }
+
+        const { stdout } = await execFile(options.targetFile, [], { encoding: 'utf8' });
+        assert.strictEqual(stdout, 'Changed!\n');
+      } finally {
+        await fs.rm(tmpdir, { recursive: true, force: true });
+      }
+    });
+
+    it('builds multiple targets at once', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const targetFiles = ['example-a', 'example-b', 'example-c'].map(
+        name => path.resolve(__dirname, `resources/${name}${exeSuffix}`));
+      // Records when each distinct build compiles Node.js. example-b is a
+      // copy of example-a, and example-c is built concurrently with it,
+      // sharing the jobserver.
+      const compileIntervals: Record<string, [number, number]> = {};
+      const recordingLogger = (target: string) => {
+        let currentStep = '';
+        return {
+          stepStarting (info: string) {
+            currentStep = info;
+            // Only the first compilation pass is recorded.
+            if (info === 'Compiling Node.js from source' && !compileIntervals[target]) {
+              compileIntervals[target] = [Date.now(), Infinity];
+            }
+          },
+          stepCompleted () {
+            if (currentStep === 'Compiling Node.js from source' && compileIntervals[target][1] === Infinity) {
+              compileIntervals[target][1] = Date.now();
+            }
+            currentStep = '';
+          },
+          stepFailed () {},
+          startProgress () {},
+          doProgress () {}
+        };
+      };
+      await compileJSFileAsBinaries(targetFiles.map((targetFile, i) => ({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        logger: recordingLogger(path.basename(targetFile)),
+        useCodeCache: i === 2
+      })));
+
+      for (const targetFile of targetFiles) {
+        const { stdout } = await execFile(targetFile, ['42'], { encoding: 'utf8' });
+        assert.strictEqual(stdout, '42\n');
+      }
+      const hasCodeCache = await Promise.all(targetFiles.map(async targetFile =>
+        (await execFile(targetFile, ['process.boxednode.hasCodeCache'], { encoding: 'utf8' })).stdout));
+      assert.deepStrictEqual(hasCodeCache, ['false\n', 'false\n', 'true\n']);
+
+      assert.deepStrictEqual(Object.keys(compileIntervals).sort(), [
+        `example-a${exeSuffix}`, `example-c${exeSuffix}`]);
+      const [startA, endA] = compileIntervals[`example-a${exeSuffix}`];
+      const [startC, endC] = compileIntervals[`example-c${exeSuffix}`];
+      assert(startA < endC && startC < endA, 'Distinct targets should be compiled concurrently');
+
+      // Distinct builds cannot share an explicit tmpdir.
+      await assert.rejects(compileJSFileAsBinaries(targetFiles.slice(1).map((targetFile, i) => ({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        tmpdir: path.join(os.tmpdir(), 'boxednode-shared-tmpdir'),
+        useCodeCache: i === 1
+      }))), /cannot share the tmpdir/);
+    });
+
+    it('works with ES module entry points', async function () {
+      if (semver.lt(version, '14.0.0')) {
+        return this.skip(); // vm.SourceTextModule code caches not available
+      }
+
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const targets = ['js', 'mjs'].map(ext => ({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, `resources/example.${ext}`),
+        targetFile: path.resolve(__dirname, `resources/example-${ext}${exeSuffix}`),
+        namespace: `example-${ext}`,
+        useCodeCache: true
+      }));
+      await compileJSFileAsBinaries(targets);
+
+      const startupTimes: Record<string, number> = {};
+      for (const { targetFile, namespace } of targets) {
+        {
+          const { stdout } = await execFile(targetFile, [], { encoding: 'utf8' });
+          assert.strictEqual(stdout, 'Hello world!\n');
+        }
+        {
+          const { stdout } = await execFile(targetFile, ['JSON.stringify(process.boxednode)'], { encoding: 'utf8' });
+          const parsed = JSON.parse(stdout);
+          assert.strictEqual(parsed.hasCodeCache, true);
+          assert([false, undefined].includes(parsed.rejectedCodeCache));
+        }
+
+        startupTimes[namespace] = await medianStartupTime(targetFile);
+      }
+      console.log('Median startup time (ms):', startupTimes);
+      // ES module entry points should start about as fast as CommonJS ones;
+      // the margin absorbs timing noise on shared CI machines.
+      assert(startupTimes['example-mjs'] <= startupTimes['example-js'] * 1.5 + 10,
+        `ES module entry point starts up too slowly: ${JSON.stringify(startupTimes)}`);
+    });
+
+    it('works with multiple entry points', async function () {
+      if (semver.lt(version, '14.0.0')) {
+        return this.skip(); // vm.SourceTextModule code caches not available
+      }
+
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const multiEntryFile = path.resolve(__dirname, `resources/example-multi${exeSuffix}`);
+      const standaloneFiles = {
+        '': path.resolve(__dirname, `resources/example-js${exeSuffix}`),
+        'example-mjs': path.resolve(__dirname, `resources/example-mjs${exeSuffix}`)
+      };
+      await compileJSFileAsBinaries([
+        {
+          nodeVersionRange: version,
+          sourceFile: path.resolve(__dirname, 'resources/example.js'),
+          entryPoints: { 'example-mjs': path.resolve(__dirname, 'resources/example.mjs') },
+          targetFile: multiEntryFile,
+          namespace: 'example-multi',
+          useCodeCache: true
+        },
+        ...['js', 'mjs'].map(ext => ({
+          nodeVersionRange: version,
+          sourceFile: path.resolve(__dirname, `resources/example.${ext}`),
+          targetFile: path.resolve(__dirname, `resources/example-${ext}${exeSuffix}`),
+          namespace: `example-${ext}`,
+          useCodeCache: true
+        }))
+      ]);
+
+      // Entry points can be selected through the executable name, too.
+      const renamedFile = path.resolve(__dirname, `resources/example-mjs-renamed/example-mjs${exeSuffix}`);
+      await fs.mkdir(path.dirname(renamedFile), { recursive: true });
+      await fs.copyFile(multiEntryFile, renamedFile);
+
+      for (const [file, args, entryPoint] of [
+        [multiEntryFile, [], ''],
+        [multiEntryFile, ['example-mjs'], 'example-mjs'],
+        [renamedFile, [], 'example-mjs']
+      ] as [string, string[], string][]) {
+        {
+          const { stdout } = await execFile(file, args, { encoding: 'utf8' });
+          assert.strictEqual(stdout, 'Hello world!\n');
+        }
+        {
+          const { stdout } = await execFile(file, [...args, 'JSON.stringify([process.argv.length, process.boxednode])'], { encoding: 'utf8' });
+          const [argvLength, parsed] = JSON.parse(stdout);
+          assert.strictEqual(argvLength, 3);
+          assert.strictEqual(parsed.entryPoint, entryPoint);
+          assert.strictEqual(parsed.hasCodeCache, true);
+          assert([false, undefined].includes(parsed.rejectedCodeCache));
+        }
+      }
+
+      const startupTimes: Record<string, { multiEntry: number, standalone: number }> = {};
+      for (const [entryPoint, standaloneFile] of Object.entries(standaloneFiles)) {
+        startupTimes[entryPoint || '(default)'] = {
+          multiEntry: await medianStartupTime(multiEntryFile, entryPoint ? [entryPoint] : []),
+          standalone: await medianStartupTime(standaloneFile)
+        };
+      }
+      console.log('Median startup time per entry point (ms):', startupTimes);
+      // Bundling several entry points must not slow down any one of them
+      // noticeably compared to a dedicated executable.
+      for (const [entryPoint, { multiEntry, standalone }] of Object.entries(startupTimes)) {
+        assert(multiEntry <= standalone * 1.25 + 10,
+          `Entry point ${entryPoint} starts up too slowly: ${multiEntry}ms vs. ${standalone}ms`);
+      }
+    });
+
+    it('works as a shared library', async function () {
+      if (process.platform === 'win32' || semver.lt(version, '18.11.0')) {
+        return this.skip();
+      }
+
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const executableFile = path.resolve(__dirname, `resources/example${exeSuffix}`);
+      const libraryFile = path.resolve(__dirname,
+        `resources/libexample${process.platform === 'darwin' ? '.dylib' : '.so'}`);
+      const hostFile = path.resolve(__dirname, 'resources/library-host');
+      await compileJSFileAsBinaries([executableFile, libraryFile].map(targetFile => ({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        useCodeCache: true,
+        sharedLibrary: targetFile === libraryFile
+      })));
+      await execFile('cc', [
+        '-o', hostFile,
+        path.resolve(__dirname, 'resources/library-host.c'),
+        `-I${path.dirname(libraryFile)}`,
+        `-L${path.dirname(libraryFile)}`,
+        '-lexample',
+        `-Wl,-rpath,${path.dirname(libraryFile)}`
+      ]);
+
+      const jobs = 50;
+      const expression = 'process.boxednode.result = String(6 * 7)';
+      let inProcessJobsPerSecond;
+      {
+        const { stdout, stderr } = await execFile(hostFile, [String(jobs), expression], { encoding: 'utf8' });
+        assert.strictEqual(stdout, '42\n'.repeat(jobs));
+        const summary = JSON.parse(stderr.trim().split('\n').pop());
+        assert.strictEqual(summary.exitCode, 0);
+        assert.strictEqual(summary.failedRuns, 0);
+        assert.strictEqual(summary.result, '42');
+        inProcessJobsPerSecond = summary.jobsPerSecond;
+      }
+
+      {
+        // process.exit() only ends the current run.
+        const { stderr } = await execFile(hostFile, ['2', 'process.boxednode.result = "exited"; process.exit(3)'], { encoding: 'utf8' });
+        const summary = JSON.parse(stderr.trim().split('\n').pop());
+        assert.strictEqual(summary.exitCode, 3);
+        assert.strictEqual(summary.failedRuns, 2);
+        assert.strictEqual(summary.result, 'exited');
+      }
+
+      {
+        // A run that called process.exit() does not leave the shared Isolate
+        // terminated for the runs that follow it.
+        const { stderr } = await execFile(hostFile, ['3', 'process.boxednode.result = "\\"quoted\\"\\n"; process.exit(0)'], { encoding: 'utf8' });
+        const summary = JSON.parse(stderr.trim().split('\n').pop());
+        assert.strictEqual(summary.exitCode, 0);
+        assert.strictEqual(summary.failedRuns, 0);
+        assert.strictEqual(summary.result, '"quoted"\n');
+      }
+
+      const start = process.hrtime.bigint();
+      for (let i = 0; i < jobs; i++) {
+        await execFile(executableFile, [expression], { encoding: 'utf8' });
+      }
+      const spawnedJobsPerSecond = jobs / (Number(process.hrtime.bigint() - start) / 1e9);
+      console.log('Jobs per second:', { inProcess: inProcessJobsPerSecond, spawned: spawnedJobsPerSecond });
+      // Re-using the Isolate skips process and V8 startup for every job.
+      assert(inProcessJobsPerSecond > spawnedJobsPerSecond,
+        `In-process runs are not faster than spawned ones: ${inProcessJobsPerSecond} vs. ${spawnedJobsPerSecond}`);
+    });
+
     it('works with a Nan addon', async function () {
       if (semver.lt(version, '12.19.0')) {
         return this.skip(); // no addon support available
@@ -165,27 +540,191 @@ describe('basic functionality', () => {
       }
     });
 
+    it('works with a N-API addon imported from an ES module', async function () {
+      if (semver.lt(version, '14.13.0')) {
+        return this.skip(); // no N-API addon support available
+      }
+
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      await compileJSFileAsBinary({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example-addon.mjs'),
+        targetFile: path.resolve(__dirname, `resources/example-addon${exeSuffix}`),
+        addons: [
+          {
+            path: path.dirname(await pkgUp({ cwd: require.resolve('weak-napi') })),
+            requireRegexp: /weakref\.node$/
+          }
+        ]
+      });
+
+      {
+        const { stdout } = await execFile(
+          path.resolve(__dirname, `resources/example-addon${exeSuffix}`), [],
+          { encoding: 'utf8' });
+        assert.strictEqual(stdout, 'function\n');
+      }
+    });
+
+    it('prepares multiple addons concurrently and re-uses them', async function () {
+      if (semver.lt(version, '14.13.0')) {
+        return this.skip(); // no N-API addon support available
+      }
+
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      // Steps of the addons are logged with their name and duration once
+      // they are done, which gives the interval in which each addon was
+      // prepared. They must not complete the build's own steps.
+      const reportedSteps: { addon: string, step: string, start: number, end: number }[] = [];
+      const events: string[] = [];
+      const logger = {
+        stepStarting (info: string) { events.push(`start ${info}`); },
+        stepCompleted () { events.push('completed'); },
+        stepFailed () { events.push('failed'); },
+        startProgress () {},
+        doProgress () {},
+        log (message: string) {
+          const match = message.match(/^\[addon ([^\]]+)\] (.+) \(([\d.]+)s\)$/);
+          if (match) {
+            const [, addon, step, duration] = match;
+            reportedSteps.push({ addon, step, start: Date.now() - +duration * 1000, end: Date.now() });
+          }
+        }
+      };
+      const options = {
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile: path.resolve(__dirname, `resources/example${exeSuffix}`),
+        logger,
+        addons: [
+          {
+            path: path.dirname(await pkgUp({ cwd: require.resolve('actual-crash') })),
+            requireRegexp: /crash\.node$/
+          },
+          {
+            path: path.dirname(await pkgUp({ cwd: require.resolve('weak-napi') })),
+            requireRegexp: /weakref\.node$/
+          }
+        ]
+      };
+      await compileJSFileAsBinary(options);
+
+      const intervals = ['actual-crash', 'weak-napi'].map(name => {
+        const steps = reportedSteps.filter(({ addon }) => addon === name);
+        assert(steps.length > 0, `No steps reported for ${name}`);
+        return [Math.min(...steps.map(({ start }) => start)), Math.max(...steps.map(({ end }) => end))];
+      });
+      assert(intervals[0][0] < intervals[1][1] && intervals[1][0] < intervals[0][1],
+        `Addons were not prepared concurrently: ${JSON.stringify(intervals)}`);
+      const preparingStep = events.indexOf('start Preparing 2 addons');
+      assert.strictEqual(events[preparingStep + 1], 'completed', events.join('\n'));
+
+      // A second build in the same source tree skips copying and installing.
+      reportedSteps.length = 0;
+      await compileJSFileAsBinary(options);
+      const stepNames = reportedSteps.map(({ addon, step }) => `${addon}: ${step}`);
+      assert(stepNames.some(step => /^actual-crash: Re-using prepared addon/.test(step)), stepNames.join('\n'));
+      assert(stepNames.some(step => /^weak-napi: Re-using prepared addon/.test(step)), stepNames.join('\n'));
+      assert(!stepNames.some(step => /: Copying addon /.test(step)), stepNames.join('\n'));
+
+      const { stdout } = await execFile(options.targetFile, [
+        'typeof require("actual-crash.node").crash + typeof require("weakref.node").WeakTag'
+      ], { encoding: 'utf8' });
+      assert.strictEqual(stdout, 'functionfunction\n');
+    });
+
+    it('resolves bindings and node-gyp-build to linked addons', async function () {
+      if (semver.lt(version, '14.13.0')) {
+        return this.skip(); // no N-API addon support available
+      }
+
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const targetFiles = {
+        patch: path.resolve(__dirname, `resources/example${exeSuffix}`),
+        noPatch: path.resolve(__dirname, `resources/example-bindings-patch${exeSuffix}`)
+      };
+      const addonPath = path.dirname(await pkgUp({ cwd: require.resolve('weak-napi') }));
+      await compileJSFileAsBinaries(Object.entries(targetFiles).map(([variant, targetFile]) => ({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        // The second alternative matches the prebuilds that node-gyp-build
+        // looks for in any package directory.
+        addons: [{ path: addonPath, requireRegexp: /weakref\.node$|[\\/]node\.napi\.node$/ }],
+        // The patch is enabled by default when addons are linked.
+        ...(variant === 'noPatch' ? { enableBindingsPatch: false } : {})
+      })));
+
+      for (const targetFile of Object.values(targetFiles)) {
+        const { stdout } = await execFile(
+          targetFile,
+          [`typeof require("bindings")("weakref.node").WeakTag + typeof require("node-gyp-build")(${JSON.stringify(addonPath)}).WeakTag + typeof require("node-gyp-build")("/some-package").WeakTag`],
+          { encoding: 'utf8' });
+        assert.strictEqual(stdout, 'functionfunctionfunction\n');
+      }
+
+      {
+        // A copy of the `bindings` package that is inlined into the source,
+        // like bundlers do, is not covered by the stand-ins.
+        const bindingsFile = require.resolve('bindings', {
+          paths: [path.dirname(await pkgUp({ cwd: require.resolve('actual-crash') }))]
+        });
+        const bundledBindings = `(function (module, exports, require) {
+          ${await fs.readFile(bindingsFile, 'utf8')}
+          return module.exports;
+        })({ exports: {} }, {}, id => id === 'file-uri-to-path' ? require('url').fileURLToPath : require(id))`;
+        const { stdout } = await execFile(
+          targetFiles.patch, [`typeof ${bundledBindings}("weakref.node").WeakTag`],
+          { encoding: 'utf8' });
+        assert.strictEqual(stdout, 'function\n');
+      }
+
+      // Error.prepareStackTrace is wrapped by the patch, e.g. when using
+      // source-map-support.
+      const errorsPerSecond: Record<string, number> = {};
+      for (const [variant, targetFile] of Object.entries(targetFiles)) {
+        const { stdout } = await execFile(targetFile, [`
+          Error.prepareStackTrace = (error, stack) => stack.map(frame => frame.getFileName()).join();
+          const count = 100000;
+          const start = process.hrtime.bigint();
+          for (let i = 0; i < count; i++) new Error().stack;
+          count / (Number(process.hrtime.bigint() - start) / 1e9)`
+        ], { encoding: 'utf8' });
+        errorsPerSecond[variant] = +stdout;
+      }
+      console.log('Errors with stack traces per second:', errorsPerSecond);
+      // Opting out of the patch is only worthwhile if it makes errors cheaper.
+      assert(errorsPerSecond.noPatch > errorsPerSecond.patch,
+        `Disabling the bindings patch did not speed up errors: ${JSON.stringify(errorsPerSecond)}`);
+    });
+
     it('passes through env vars and runs the pre-compile hook', async function () {
       this.timeout(2 * 60 * 60 * 1000); // 2 hours
-      let ranPreCompileHook = false;
+      let preCompileHookRuns = 0;
+      const marker = '\n// Appended by the pre-compile hook\n';
       async function preCompileHook (nodeSourceTree: string) {
-        ranPreCompileHook = true;
-        await fs.access(path.join(nodeSourceTree, 'lib', 'net.js'));
+        preCompileHookRuns++;
+        await fs.appendFile(path.join(nodeSourceTree, 'lib', 'net.js'), marker);
       }
-      try {
-        await compileJSFileAsBinary({
+      // A separate tmpdir, since the tree is tied to this hook.
+      const tmpdir = path.join(os.tmpdir(), 'boxednode', 'example-pre-compile-hook');
+      await fs.rm(tmpdir, { recursive: true, force: true });
+      // The hook is only applied to freshly unpacked source trees, and not
+      // again when the tree is re-used.
+      for (let i = 0; i < 2; i++) {
+        await assert.rejects(compileJSFileAsBinary({
           nodeVersionRange: version,
           sourceFile: path.resolve(__dirname, 'resources/example.js'),
           targetFile: path.resolve(__dirname, `resources/example${exeSuffix}`),
           env: { CC: 'false', CXX: 'false' },
+          tmpdir,
           preCompileHook
-        });
-      } catch (err) {
-        assert.strictEqual(ranPreCompileHook, true);
-        return;
+        }));
       }
-
-      throw new Error('unreachable');
+      assert.strictEqual(preCompileHookRuns, 1);
+      const [sourceDir] = await fs.readdir(tmpdir);
+      const net = await fs.readFile(path.join(tmpdir, sourceDir, 'lib', 'net.js'), 'utf8');
+      assert.strictEqual(net.split(marker).length, 2);
     });
 
     it('works with code caching support', async function () {
@@ -194,7 +733,8 @@ describe('basic functionality', () => {
         nodeVersionRange: version,
         sourceFile: path.resolve(__dirname, 'resources/example.js'),
         targetFile: path.resolve(__dirname, `resources/example${exeSuffix}`),
-        useCodeCache: true
+        useCodeCache: true,
+        trackStartupMemory: true
       });
 
       {
@@ -212,6 +752,163 @@ describe('basic functionality', () => {
         assert.strictEqual(parsed.hasCodeCache, true);
         assert([false, undefined].includes(parsed.rejectedCodeCache));
       }
+
+      {
+        const { stdout } = await execFile(
+          path.resolve(__dirname, `resources/example${exeSuffix}`), [
+            'process.boxednode.markTime("Whatever", "running js");JSON.stringify(process.boxednode.getTimingData())'
+          ],
+          { encoding: 'utf8' });
+        const timingData = JSON.parse(stdout);
+        const createdEnvironment = timingData.find(([, label]) => label === 'Created Environment');
+        assert(createdEnvironment[3].rss > 0);
+        assert(createdEnvironment[3].heapUsed > 0);
+        const [,,, jsMemory] = timingData[timingData.length - 1];
+        assert(jsMemory.rss > 0);
+        assert(jsMemory.heapUsed > 0);
+      }
+    });
+
+    it('works with the require() profiler', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      await compileJSFileAsBinary({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile: path.resolve(__dirname, `resources/example${exeSuffix}`),
+        useCodeCache: true,
+        profileRequire: true
+      });
+
+      const dependencyPath = path.resolve(__dirname, 'resources/require-profile.js');
+      const { stdout } = await execFile(
+        path.resolve(__dirname, `resources/example${exeSuffix}`), [`
+          require(${JSON.stringify(dependencyPath)});
+          for (let i = 0; i < 1000; i++) require.resolve(${JSON.stringify(dependencyPath)});
+          require(${JSON.stringify(dependencyPath)});
+          JSON.stringify({
+            profile: process.boxednode.getRequireProfile(),
+            timingData: process.boxednode.getTimingData()
+          })`],
+        { encoding: 'utf8' });
+      const { profile, timingData } = JSON.parse(stdout);
+      assert.strictEqual(profile.type, 'main');
+      assert.strictEqual(profile.codeCache, true);
+      assert(profile.compileTime > 0);
+
+      const [first, second] = profile.children;
+      assert.deepStrictEqual(
+        [first.request, first.type, first.filename, first.cached],
+        [dependencyPath, 'file', dependencyPath, false]);
+      assert.deepStrictEqual(
+        first.children.map(({ request, type }) => [request, type]),
+        [['path', 'builtin']]);
+      assert(first.resolveTime > 0);
+      assert(first.evaluationTime >= first.selfTime);
+      assert.strictEqual(first.selfTime, first.evaluationTime - first.children[0].totalTime);
+      assert.deepStrictEqual([second.filename, second.cached], [dependencyPath, true]);
+      // require.resolve() calls are not attributed to any module.
+      assert.strictEqual(profile.resolveTime, 0);
+
+      const labels = timingData.map(([, label]) => label);
+      assert(labels.includes(`Start require(${JSON.stringify(dependencyPath)})`));
+      assert(labels.includes('Finished require("path")'));
+    });
+
+    it('writes a build report', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const targetFile = path.resolve(__dirname, `resources/example${exeSuffix}`);
+      const reportFile = path.resolve(__dirname, 'resources/example-report.json');
+      await compileJSFileAsBinary({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        useCodeCache: true,
+        reportFile
+      });
+
+      {
+        const { stdout } = await execFile(targetFile, [], { encoding: 'utf8' });
+        assert.strictEqual(stdout, 'Hello world!\n');
+      }
+
+      // The environment variable alone does not trigger a startup report run.
+      const tmpdir = await fs.mkdtemp(path.join(os.tmpdir(), 'boxednode-test-'));
+      try {
+        const startupReportFile = path.join(tmpdir, 'startup.json');
+        const { stdout } = await execFile(targetFile, [], {
+          encoding: 'utf8',
+          env: { ...process.env, BOXEDNODE_STARTUP_REPORT_FILE: startupReportFile }
+        });
+        assert.strictEqual(stdout, 'Hello world!\n');
+        await assert.rejects(fs.access(startupReportFile));
+      } finally {
+        await fs.rm(tmpdir, { recursive: true, force: true });
+      }
+
+      const report = JSON.parse(await fs.readFile(reportFile, 'utf8'));
+      assert.strictEqual(report.size.total.raw, (await fs.stat(targetFile)).size);
+      assert(report.size.nodeCore > 0);
+      const { size, startup } = report.entryPoints['(default)'];
+      assert(size.mainSource.raw > 0);
+      assert(size.codeCache.raw > 0);
+      assert.strictEqual(size.snapshot.raw, 0);
+      assert(startup.nodeCore > 0);
+      assert(startup.mainSource > 0);
+      assert.strictEqual(startup.snapshotDeserialize, null);
+      assert(startup.marks.some(({ label }) => label === 'Decoded code cache'));
+    });
+
+    it('works with a runtime code cache', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const targetFile = path.resolve(__dirname, `resources/example${exeSuffix}`);
+      await compileJSFileAsBinary({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        useCodeCache: true,
+        runtimeCodeCache: true
+      });
+
+      const cacheDir = await fs.mkdtemp(path.join(os.tmpdir(), 'boxednode-code-cache-'));
+      try {
+        const run = async () => {
+          const { stdout } = await execFile(targetFile, ['JSON.stringify(process.boxednode)'], {
+            encoding: 'utf8',
+            env: { ...process.env, BOXEDNODE_CODE_CACHE_DIR: cacheDir }
+          });
+          return JSON.parse(stdout);
+        };
+
+        {
+          const parsed = await run();
+          assert.strictEqual(parsed.hasCodeCache, true);
+          assert.strictEqual(parsed.usesRuntimeCodeCache, false);
+        }
+        const cacheFiles = await fs.readdir(cacheDir);
+        assert.strictEqual(cacheFiles.length, 1);
+        {
+          const parsed = await run();
+          assert.strictEqual(parsed.usesRuntimeCodeCache, true);
+          assert.strictEqual(parsed.rejectedCodeCache, false);
+        }
+
+        // A rejected runtime code cache is replaced.
+        const cacheFile = path.join(cacheDir, cacheFiles[0]);
+        await fs.writeFile(cacheFile, 'not a code cache');
+        {
+          const parsed = await run();
+          assert.strictEqual(parsed.usesRuntimeCodeCache, true);
+          assert.strictEqual(parsed.rejectedCodeCache, true);
+        }
+        {
+          const parsed = await run();
+          assert.strictEqual(parsed.usesRuntimeCodeCache, true);
+          assert.strictEqual(parsed.rejectedCodeCache, false);
+        }
+        assert.deepStrictEqual(await fs.readdir(cacheDir), cacheFiles);
+      } finally {
+        await fs.rm(cacheDir, { recursive: true, force: true });
+      }
     });
 
     for (const compressBlobs of [false, true]) {
@@ -239,8 +936,174 @@ describe('basic functionality', () => {
           assert.strictEqual(originalArgv.length, 2); // [execPath, execPath]
           assert.strictEqual(timingData[0][0], 'Node.js Instance');
           assert.strictEqual(timingData[0][1], 'Process initialization');
+          // The snapshot is decoded on a background thread that is started
+          // once stdio has been initialized, and joined before the Isolate
+          // is created.
+          const timeOf = (label: string) => timingData.find(([, l]) => l === label)[2];
+          assert(timeOf('Finished InitializeOncePerProcess') <= timeOf('Started decoding blobs'));
+          assert(timeOf('Decoded snapshot') <= timeOf('Joined blob prefetch thread'));
         }
       });
     }
+
+    it('works with embedded userland modules in a snapshot', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      await compileJSFileAsBinary({
+        nodeVersionRange: '^20.13.0',
+        sourceFile: path.resolve(__dirname, 'resources/module-graph/index.js'),
+        targetFile: path.resolve(__dirname, `resources/snapshot-module-graph${exeSuffix}`),
+        namespace: 'snapshot-module-graph',
+        useNodeSnapshot: true,
+        embedModuleGraph: true,
+        embeddedFiles: [path.resolve(__dirname, 'resources/module-graph/lib')],
+        nodeSnapshotConfigFlags: ['WithoutCodeCache'],
+        // the nightly path name is too long for Windows...
+        tmpdir: process.platform === 'win32' ? path.join(os.tmpdir(), 'bn') : undefined
+      });
+
+      const { stdout } = await execFile(
+        path.resolve(__dirname, `resources/snapshot-module-graph${exeSuffix}`), [],
+        { encoding: 'utf8' });
+      assert.deepStrictEqual(JSON.parse(stdout), {
+        greeting: 'Hello, snapshot!',
+        evaluatedDuringSnapshot: true,
+        entryName: 'entry',
+        dynamic: 42
+      });
+    });
+
+    it('works with a decompressed blob cache', async function () {
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      await compileJSFileAsBinary({
+        nodeVersionRange: '^20.13.0',
+        sourceFile: path.resolve(__dirname, 'resources/snapshot-echo-args.js'),
+        targetFile: path.resolve(__dirname, `resources/snapshot-echo-args${exeSuffix}`),
+        useNodeSnapshot: true,
+        compressBlobs: true,
+        cacheDecompressedBlobs: true,
+        nodeSnapshotConfigFlags: ['WithoutCodeCache'],
+        // the nightly path name is too long for Windows...
+        tmpdir: process.platform === 'win32' ? path.join(os.tmpdir(), 'bn') : undefined
+      });
+
+      // Returns the blob cache timing labels of a run.
+      const run = async (cacheDir: string): Promise<string[]> => {
+        const { stdout } = await execFile(
+          path.resolve(__dirname, `resources/snapshot-echo-args${exeSuffix}`), ['a', 'b', 'c'],
+          { encoding: 'utf8', env: { ...process.env, BOXEDNODE_BLOB_CACHE_DIR: cacheDir } });
+        const { currentArgv, timingData } = JSON.parse(stdout);
+        assert.deepStrictEqual(currentArgv.slice(2), ['a', 'b', 'c']);
+        return timingData
+          .filter(([category]) => category === 'Boxednode Blob Cache')
+          .map(([, label]) => label);
+      };
+      const cacheDir = await fs.mkdtemp(path.join(os.tmpdir(), 'boxednode-blob-cache-'));
+      try {
+        const labels = [await run(cacheDir), await run(cacheDir)];
+        assert(labels[0].includes('Cache miss: GetBoxednodeSnapshotBlob'), `Missed cache miss in ${labels[0]}`);
+        assert(labels[1].includes('Cache hit: GetBoxednodeSnapshotBlob'), `Missed cache hit in ${labels[1]}`);
+        const cacheFiles = await fs.readdir(cacheDir);
+        assert.strictEqual(cacheFiles.filter(f => f.endsWith('.tmp')).length, 0);
+
+        // Corrupted cache files of the right size are detected and replaced.
+        const cacheFile = path.join(cacheDir, cacheFiles.find(f => f.startsWith('GetBoxednodeSnapshotBlob')));
+        const contents = await fs.readFile(cacheFile);
+        contents[contents.length >> 1] ^= 0xff;
+        await fs.writeFile(cacheFile, contents);
+        {
+          const labels = await run(cacheDir);
+          assert(labels.includes('Cache miss: GetBoxednodeSnapshotBlob'), `Missed cache miss in ${labels}`);
+        }
+        {
+          const labels = await run(cacheDir);
+          assert(labels.includes('Cache hit: GetBoxednodeSnapshotBlob'), `Missed cache hit in ${labels}`);
+        }
+
+        // Missing and (unless running as root) read-only cache directories
+        // fall back to in-memory decoding.
+        {
+          const labels = await run(path.join(cacheDir, 'missing', 'dir'));
+          assert(labels.includes('Cache unavailable'), `Missed unavailable cache in ${labels}`);
+        }
+        if (process.platform !== 'win32' && process.getuid() !== 0) {
+          const readOnlyDir = path.join(cacheDir, 'read-only');
+          await fs.mkdir(readOnlyDir, { mode: 0o500 });
+          const labels = await run(readOnlyDir);
+          assert(labels.includes('Cache unavailable'), `Missed unavailable cache in ${labels}`);
+          assert.deepStrictEqual(await fs.readdir(readOnlyDir), []);
+        }
+      } finally {
+        await fs.rm(cacheDir, { recursive: true, force: true });
+      }
+    });
+
+    it('works with large pages', async function () {
+      if (semver.lt(version, '18.11.0')) {
+        return this.skip(); // --use-largepages is only passed on 18.11.0+
+      }
+
+      this.timeout(2 * 60 * 60 * 1000); // 2 hours
+      const targetFiles = {
+        off: path.resolve(__dirname, `resources/example${exeSuffix}`),
+        text: path.resolve(__dirname, `resources/example-large-pages${exeSuffix}`)
+      };
+      await compileJSFileAsBinaries(Object.entries(targetFiles).map(([largePages, targetFile]) => ({
+        nodeVersionRange: version,
+        sourceFile: path.resolve(__dirname, 'resources/example.js'),
+        targetFile,
+        useCodeCache: true,
+        largePages: largePages as 'off' | 'text'
+      })));
+
+      // A CPU-bound workload that touches a lot of different code in V8 and
+      // Node.js, where iTLB misses are noticeable. Also reports how much of the
+      // executable code is backed by huge pages (which depends on THP
+      // availability on the machine that runs the tests).
+      const workload = `
+        const zlib = require('zlib');
+        const crypto = require('crypto');
+        const input = JSON.stringify(Array.from({ length: 200 }, (_, i) => ({ i, s: 'x'.repeat(i % 20) })));
+        let ops = 0;
+        let checksum = '';
+        const start = process.hrtime.bigint();
+        while (Number(process.hrtime.bigint() - start) < 2e9) {
+          const parsed = JSON.parse(input);
+          const text = parsed.map(({ i, s }) => new Intl.NumberFormat('en-US').format(i * 1000) + s).join(',');
+          checksum = crypto.createHash('sha256').update(zlib.deflateSync(text.replace(/x+/g, m => m.length))).digest('hex');
+          ops++;
+        }
+        let hugeTextKb = 0;
+        if (process.platform === 'linux') {
+          let executable = false;
+          for (const line of require('fs').readFileSync('/proc/self/smaps', 'utf8').split('\\n')) {
+            if (/^[0-9a-f]+-[0-9a-f]+ /.test(line)) executable = line.split(' ')[1].includes('x');
+            else if (executable && line.startsWith('AnonHugePages:')) hugeTextKb += parseInt(line.split(/\\s+/)[1]);
+          }
+        }
+        JSON.stringify({ opsPerSecond: ops / 2, hugeTextKb, checksum })`;
+      const results: Record<string, any> = {};
+      for (const [largePages, targetFile] of Object.entries(targetFiles)) {
+        const { stdout } = await execFile(targetFile, [workload], { encoding: 'utf8' });
+        results[largePages] = JSON.parse(stdout);
+      }
+      assert.strictEqual(results.off.checksum, results.text.checksum);
+      console.log('Large pages throughput:', results);
+      // Node.js only remaps code onto huge pages on x64.
+      let thpAvailable = false;
+      if (process.platform === 'linux' && process.arch === 'x64') {
+        try {
+          const thpMode = await fs.readFile('/sys/kernel/mm/transparent_hugepage/enabled', 'utf8');
+          thpAvailable = !thpMode.includes('[never]');
+        } catch {}
+      }
+      if (thpAvailable) {
+        assert(results.text.hugeTextKb > 0, `No code on huge pages: ${JSON.stringify(results)}`);
+      }
+
+      {
+        const { stdout } = await execFile(targetFiles.text, [], { encoding: 'utf8' });
+        assert.strictEqual(stdout, 'Hello world!\n');
+      }
+    });
   });
 });
@@ -0,0 +1,3 @@
+import { WeakTag } from 'weakref.node';
+
+console.log(typeof WeakTag);
@@ -0,0 +1,5 @@
+if (process.argv[2]) {
+  console.log(eval(process.argv[2]));
+} else {
+  console.log('Hello world!');
+}
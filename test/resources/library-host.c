@@ -0,0 +1,54 @@
+// Runs the default entry point of a boxednode shared library repeatedly,
+// passing the remaining arguments to it, and prints the exit code and result
+// of the last run, the number of runs that exited with a non-zero code and the
+// number of runs per second to stderr.
+// Usage: library-host <runs> [args...]
+#include "boxednode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void print_json_string(FILE* out, const char* str) {
+  fputc('"', out);
+  for (const unsigned char* c = (const unsigned char*)str; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(out, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(out, "\\u%04x", *c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) return 2;
+  int runs = atoi(argv[1]);
+  const char* node_argv[] = { argv[0] };
+  if (boxednode_initialize(1, node_argv) != 0) return 1;
+  boxednode_instance* instance = boxednode_instance_create(NULL);
+  if (instance == NULL) return 1;
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int exit_code = 0;
+  int failed_runs = 0;
+  char* result = NULL;
+  for (int i = 0; i < runs; i++) {
+    boxednode_free(result);
+    exit_code = boxednode_instance_run(
+        instance, argc - 2, (const char* const*)argv + 2, &result);
+    if (exit_code != 0) failed_runs++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  fprintf(stderr, "{\"exitCode\":%d,\"failedRuns\":%d,\"result\":", exit_code, failed_runs);
+  print_json_string(stderr, result != NULL ? result : "");
+  fprintf(stderr, ",\"jobsPerSecond\":%f}\n", runs / seconds);
+  boxednode_free(result);
+  boxednode_instance_dispose(instance);
+  boxednode_teardown();
+  return 0;
+}
@@ -0,0 +1,16 @@
+const {
+  setDeserializeMainFunction
+} = require('v8').startupSnapshot;
+exports.name = 'entry';
+const { greet, evaluatedDuringSnapshot, entryName } = require('./lib/greet');
+const { name } = require('./data.json');
+
+setDeserializeMainFunction(() => {
+  const dynamicModule = './lib/' + 'dynamic';
+  console.log(JSON.stringify({
+    greeting: greet(name),
+    evaluatedDuringSnapshot,
+    entryName,
+    dynamic: require(dynamicModule).value
+  }));
+});
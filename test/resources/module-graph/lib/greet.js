@@ -0,0 +1,4 @@
+exports.greet = (name) => `Hello, ${name}!`;
+exports.evaluatedDuringSnapshot = require('v8').startupSnapshot.isBuildingSnapshot();
+// Circular require() of the entry point, which returns its partial exports.
+exports.entryName = require('../index').name;
@@ -0,0 +1,4 @@
+'use strict';
+// Loaded from the file system in the require() profiler test.
+const { basename } = require('path');
+module.exports = basename(__filename);